@@ -1,8 +1,11 @@
 #include <algorithm>
+#include <cassert>
 #include <iostream>
 #include <vector>
 
+#include "../include/intrusive_ring.hh"
 #include "../include/ring.hh"
+#include "../include/small_ring.hh"
 #include "../include/util.hh"
 
 template <template <typename...> typename Container, typename... Ts>
@@ -112,6 +115,51 @@ auto main() -> int {
         std::cout << "move: " << move << '\n';
     }
 
+    // small rings
+    {
+        std::cout << "\n\nrings that don't allocate\n\n";
+        auto small = SmallRing<int, 8>({ 1, 2, 3, 4, 5 });
+        small.insert(6, Direction::Front);
+        std::cout << "small: ";
+        for (auto const& e : small) { std::cout << e << ", "; }
+        std::cout << "(inline slots left: " << small.inline_available() << ")\n";
+
+        // arrays keep their order in either direction, same as in Ring
+        auto ring = Ring<int>({ 1, 2 });
+        auto both = SmallRing<int, 4>({ 1, 2 });
+        ring.insert({ 3, 4, 5 }, Direction::Back);
+        both.insert({ 3, 4, 5 }, Direction::Back);
+        auto same = std::equal(ring.begin(), ring.end(), both.begin(), both.end());
+        assert(same && "SmallRing links arrays like Ring");
+        std::cout << "both: ";
+        for (auto const& e : both) { std::cout << e << ", "; }
+        std::cout << "(same as ring: " << std::boolalpha << same << ")\n";
+
+        constexpr auto fixed = FixedRing({ 1, 2, 3, 4, 5 });
+        static_assert(fixed.size() == 5, "fixed ring is built at compile time");
+        std::cout << "fixed: ";
+        for (auto const& e : fixed) { std::cout << e << ", "; }
+        std::cout << '\n';
+    }
+
+    // intrusive
+    {
+        std::cout << "\n\nlinking objects that live elsewhere\n\n";
+        struct Job {
+            int           id;
+            RingHook<Job> hook;
+        };
+        Job jobs[3] = { { 1, {} }, { 2, {} }, { 3, {} } };
+
+        auto ring = IntrusiveRing<Job, &Job::hook> {};
+        for (auto& job : jobs) { ring.insert(job, Direction::Front); }
+        ring.rotate(ring.find([] (auto const& it) { return it->id == 2; }));
+
+        std::cout << "ring: ";
+        for (auto const& job : ring) { std::cout << job.id << ", "; }
+        std::cout << "\npopped: " << ring.pop(ring.first()).id << '\n';
+    }
+
     // single node
     {
         std::cout << "\n\ntests on rings containing only one or zero nodes\n\n";
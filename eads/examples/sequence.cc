@@ -1,5 +1,6 @@
 #include <functional>
 
+#include "../include/intrusive_sequence.hh"
 #include "../include/sequence.hh"
 
 template <typename Key, typename Info>
@@ -118,6 +119,23 @@ auto main() -> int {
         auto move = seq::Sequence<int, int> { std::move(copy) };
         move.print();
     }
+
+    {
+        struct Conn {
+            int                     fd;
+            seq::SequenceHook<Conn> hook;
+        };
+        Conn conns[3] = { { 3, {} }, { 4, {} }, { 5, {} } };
+
+        auto seq = seq::IntrusiveSequence<Conn, &Conn::hook> {};
+        seq.append(conns[1]).append(conns[2]).insert(conns[0]);
+        assert(&seq.first() == &conns[0] && "objects are linked, not copied");
+        [[maybe_unused]] auto& last = seq.popb();
+        assert(&last == &conns[2] && "last linked object is conns[2]");
+
+        for (auto const& conn : seq) { std::cout << conn.fd << ' '; }
+        std::cout << '\n';
+    }
 }
 
 
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+#include "ring.hh"
+
+/** @file intrusive_ring.hh */
+
+/**
+ * @class RingHook
+ * links embedded in user type T so it can be put into an IntrusiveRing.
+ * a single object can be in as many rings as it has hooks.
+ */
+template <typename T>
+struct RingHook {
+    T* next = nullptr;
+    T* prev = nullptr;
+
+    auto linked() const -> bool { return next != nullptr; }
+};
+
+/**
+ * @class IntrusiveRing
+ * Ring linking objects that live elsewhere through their embedded RingHook,
+ * nothing is allocated or copied. the ring doesn't own the objects, they
+ * have to outlive their membership in the ring.
+ *
+ *  struct Job { int id; RingHook<Job> hook; };
+ *  auto ring = IntrusiveRing<Job, &Job::hook> {};
+ */
+template <typename T, RingHook<T> T::* Hook>
+struct IntrusiveRing {
+    using size_type = std::size_t;
+
+    template <typename Value>
+    struct IteratorImpl {
+        using difference_type   = size_type;
+        using value_type        = Value;
+        using pointer           = value_type*;
+        using reference         = value_type&;
+        using iterator_category = std::bidirectional_iterator_tag;
+
+        IteratorImpl(pointer p) : current { p }, first { p } {}
+
+        auto operator ==(IteratorImpl const& rhs) const -> bool {
+            return current == rhs.current;
+        }
+
+        auto operator !=(IteratorImpl const& rhs) const -> bool {
+            return current != rhs.current;
+        }
+
+        auto operator ++() -> IteratorImpl& {
+            auto* next = hook(current).next;
+            current = next != first ? next : nullptr;
+            return *this;
+        }
+
+        auto operator ++(int) -> IteratorImpl {
+            auto ret = *this;
+            ++*this;
+            return ret;
+        }
+
+        auto operator --() -> IteratorImpl& {
+            current = current ? hook(current).prev : hook(first).prev;
+            return *this;
+        }
+
+        auto operator --(int) -> IteratorImpl {
+            auto ret = *this;
+            --*this;
+            return ret;
+        }
+
+        auto operator *() const -> reference { return *current; }
+        auto operator ->() const -> pointer { return current; }
+
+        friend struct IntrusiveRing;
+        private:
+        pointer current;
+        pointer first;
+    };
+
+    using Iterator      = IteratorImpl<T>;
+    using ConstIterator = IteratorImpl<T const>;
+
+    auto begin() -> Iterator { return Iterator { first_ }; }
+    auto begin() const -> ConstIterator { return ConstIterator { first_ }; }
+    auto end() -> Iterator { return Iterator { nullptr }; }
+    auto end() const -> ConstIterator { return ConstIterator { nullptr }; }
+
+    IntrusiveRing() = default;
+    ~IntrusiveRing() {
+        clear();
+    }
+
+    // objects can be linked into only one ring through a given hook
+    IntrusiveRing(IntrusiveRing const&) = delete;
+    auto operator =(IntrusiveRing const&) -> IntrusiveRing& = delete;
+
+    IntrusiveRing(IntrusiveRing&& other) : first_ { other.first_ } {
+        other.first_ = nullptr;
+    }
+
+    auto operator =(IntrusiveRing&& other) -> IntrusiveRing& {
+        std::swap(first_, other.first_);
+        return *this;
+    }
+
+    auto empty() const -> bool { return first_ == nullptr; }
+
+    /**
+     * unlink every object, objects themselves are left untouched
+     */
+    auto clear() -> void {
+        if (!first_) { return; }
+        auto* current = first_;
+        do {
+            auto* del = current;
+            current = hook(current).next;
+            hook(del) = {};
+        } while (current != first_);
+        first_ = nullptr;
+    }
+
+    auto first() -> Iterator { return Iterator { first_ }; }
+    auto first() const -> ConstIterator { return ConstIterator { first_ }; }
+    auto last() -> Iterator { return Iterator { hook(first_).prev }; }
+    auto last() const -> ConstIterator {
+        return ConstIterator { hook(first_).prev };
+    }
+
+    /**
+     * find object given by predicate f, return iterator to it
+     * @return iterator given by predicate f
+     */
+    template <typename F>
+    auto find(F const& f) -> Iterator {
+        auto it = begin();
+        for (; it != end(); ++it) {
+            util::count::visit();
+            if (f(it)) { break; }
+        }
+        return it;
+    }
+
+    template <typename F>
+    auto find(F const& f) const -> ConstIterator {
+        auto it = begin();
+        for (; it != end(); ++it) {
+            util::count::visit();
+            if (f(it)) { break; }
+        }
+        return it;
+    }
+
+    /**
+     * link object t, which can't be linked through Hook already.
+     * @return iterator at linked object
+     */
+    auto insert(T& t, Direction dir) -> Iterator {
+        if (empty()) {
+            hook(&t) = { &t, &t };
+            return Iterator { first_ = &t };
+        } else {
+            return insert_at(first(), t, dir);
+        }
+    }
+
+    /**
+     * link object t next to position pos, in front of it or behind it
+     * depending on dir, same as Ring does.
+     * @return iterator at linked object
+     */
+    static auto insert_at(Iterator const& pos, T& t, Direction dir)
+        -> Iterator {
+        auto* after  = dir == Direction::Front
+            ? pos.current
+            : hook(pos.current).next;
+        auto* before = hook(after).prev;
+        hook(&t)      = { after, before };
+        hook(before).next = &t;
+        hook(after).prev  = &t;
+        return Iterator { &t };
+    }
+
+    /**
+     * change which object the ring starts at. pos has to point into this ring.
+     * @return iterator at previous first object
+     */
+    auto rotate(Iterator const& pos) -> Iterator {
+        auto ret = Iterator { first_ };
+        first_ = pos.current;
+        return ret;
+    }
+
+    /**
+     * unlink object at pos
+     * @return unlinked object
+     */
+    auto pop(Iterator const& pos) -> T& {
+        auto* del = pos.current;
+        if (del == first_) {
+            first_ = hook(del).next != del ? hook(del).next : nullptr;
+        }
+        hook(hook(del).prev).next = hook(del).next;
+        hook(hook(del).next).prev = hook(del).prev;
+        hook(del) = {};
+        return *del;
+    }
+
+    static auto swap(IntrusiveRing& a, IntrusiveRing& b) -> void {
+        std::swap(a.first_, b.first_);
+    }
+
+    private:
+    static auto hook(T* t) -> RingHook<T>& { return t->*Hook; }
+    static auto hook(T const* t) -> RingHook<T> const& { return t->*Hook; }
+
+    T* first_ = {};
+};
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <cassert>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+#include "stats.hh"
+
+/** @file intrusive_sequence.hh */
+
+namespace seq {
+/**
+ * @class SequenceHook
+ * link embedded in user type T so it can be put into an IntrusiveSequence
+ */
+template <typename T>
+struct SequenceHook {
+    T* next = nullptr;
+};
+
+/**
+ * @class IntrusiveSequence
+ * Sequence linking objects that live elsewhere through their embedded
+ * SequenceHook, nothing is allocated or copied. the sequence doesn't own
+ * the objects, they have to outlive their membership in the sequence.
+ *
+ *  struct Conn { int fd; seq::SequenceHook<Conn> hook; };
+ *  auto conns = seq::IntrusiveSequence<Conn, &Conn::hook> {};
+ */
+template <typename T, SequenceHook<T> T::* Hook>
+struct IntrusiveSequence {
+    IntrusiveSequence() = default;
+
+    // objects can be linked into only one sequence through a given hook
+    IntrusiveSequence(IntrusiveSequence const&) = delete;
+    auto operator =(IntrusiveSequence const&) -> IntrusiveSequence& = delete;
+
+    IntrusiveSequence(IntrusiveSequence&& other) noexcept
+        : head_ { other.head_ } {
+        other.head_ = nullptr;
+    }
+
+    auto operator =(IntrusiveSequence&& other) noexcept -> IntrusiveSequence& {
+        std::swap(head_, other.head_);
+        return *this;
+    }
+
+    ~IntrusiveSequence() {
+        clear();
+    }
+
+    auto empty() const -> bool { return !head_; }
+
+    /**
+     * unlink every object, objects themselves are left untouched
+     */
+    auto clear() -> void {
+        while (head_) {
+            head_ = std::exchange(hook(head_).next, nullptr);
+        }
+    }
+
+    /**
+     * returns reference to first object, fires assertion if sequence is empty.
+     * @return reference to first object in sequence
+     */
+    auto first() const -> T const& {
+        assert(!empty() && "using first on empty list");
+        return *head_;
+    }
+
+    auto first() -> T& {
+        return const_cast<T&>(const_cast<IntrusiveSequence const*>(this)->first());
+    }
+
+    /**
+     * returns reference to last object, fires assertion if sequence is empty.
+     * @return reference to last object in sequence
+     */
+    auto last() const -> T const& {
+        assert(!empty() && "using last on empty list");
+        auto const* node = head_;
+        while (hook(node).next) {
+            util::count::visit();
+            node = hook(node).next;
+        }
+        return *node;
+    }
+
+    auto last() -> T& {
+        return const_cast<T&>(const_cast<IntrusiveSequence const*>(this)->last());
+    }
+
+    /**
+     * links object in front of the sequence.
+     * @return self
+     */
+    auto insert(T& t) -> IntrusiveSequence& {
+        hook(&t).next = std::exchange(head_, &t);
+        return *this;
+    }
+
+    /**
+     * links object at the end of the sequence.
+     * @return self
+     */
+    auto append(T& t) -> IntrusiveSequence& {
+        hook(&t).next = nullptr;
+        if (empty()) {
+            head_ = &t;
+        } else {
+            hook(&last()).next = &t;
+        }
+        return *this;
+    }
+
+    /**
+     * unlinks and returns first object of the sequence, asserts on empty.
+     * @return unlinked object
+     */
+    auto popf() -> T& {
+        assert(!empty() && "popf on empty sequence");
+        auto* ret = head_;
+        head_ = std::exchange(hook(ret).next, nullptr);
+        return *ret;
+    }
+
+    /**
+     * unlinks and returns last object of the sequence, asserts on empty.
+     * @return unlinked object
+     */
+    auto popb() -> T& {
+        assert(!empty() && "popb on empty sequence");
+        auto* link = &head_;
+        while (hook(*link).next) {
+            util::count::visit();
+            link = &hook(*link).next;
+        }
+        return *std::exchange(*link, nullptr);
+    }
+
+    /**
+     * @class IteratorImpl
+     * iterator over links, which allows for linking at its position
+     */
+    template <typename Value, typename Link>
+    struct IteratorImpl {
+        using iterator_category = std::forward_iterator_tag;
+        using value_type        = Value;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = value_type*;
+        using reference         = value_type&;
+
+        Link* link_;
+
+        auto operator ++() -> IteratorImpl& {
+            link_ = &hook(*link_).next;
+            return *this;
+        }
+
+        auto operator *() const -> reference { return **link_; }
+        auto operator ->() const -> pointer { return *link_; }
+    };
+
+    using Iterator      = IteratorImpl<T, T*>;
+    using ConstIterator = IteratorImpl<T const, T* const>;
+
+    auto begin() -> Iterator { return Iterator { &head_ }; }
+    auto begin() const -> ConstIterator { return ConstIterator { &head_ }; }
+
+    struct IterEnd {};
+
+    auto end() const -> IterEnd { return IterEnd {}; }
+
+    template <typename Value, typename Link>
+    friend auto operator !=(IteratorImpl<Value, Link> const& iter, IterEnd const&)
+        -> bool {
+        return *iter.link_ != nullptr;
+    }
+
+    template <typename Value, typename Link>
+    friend auto operator ==(IteratorImpl<Value, Link> const& iter, IterEnd const&)
+        -> bool {
+        return *iter.link_ == nullptr;
+    }
+
+    /**
+     * link object at position denoted by iterator.
+     * @return self
+     */
+    auto insert_at(Iterator const& iter, T& t) -> IntrusiveSequence& {
+        hook(&t).next = std::exchange(*iter.link_, &t);
+        return *this;
+    }
+
+    /**
+     * get iterator at object for which func returned true.
+     * if no such object exists return iterator to one pass the end
+     */
+    template <typename F>
+    auto get_iter_by(F const& func) -> Iterator {
+        auto it = begin();
+        for (; it != end(); ++it) {
+            util::count::visit();
+            if (func(*it)) { break; }
+        }
+        return it;
+    }
+
+    template <typename F>
+    auto get_iter_by(F const& func) const -> ConstIterator {
+        auto it = begin();
+        for (; it != end(); ++it) {
+            util::count::visit();
+            if (func(*it)) { break; }
+        }
+        return it;
+    }
+
+    /**
+     * unlink first object fulfilling predicate func.
+     * if no object does do nothing
+     * @return self
+     */
+    template <typename F>
+    auto remove_if(F const& func) -> IntrusiveSequence& {
+        auto it = get_iter_by(func);
+        if (it != end()) {
+            *it.link_ = std::exchange(hook(*it.link_).next, nullptr);
+        }
+        return *this;
+    }
+
+private:
+    static auto hook(T* t) -> SequenceHook<T>& { return t->*Hook; }
+    static auto hook(T const* t) -> SequenceHook<T> const& { return t->*Hook; }
+
+    T* head_ = nullptr;
+};
+}
+
+// Local Variables:
+// flycheck-clang-language-standard: "c++17"
+// flycheck-gcc-language-standard:   "c++17"
+// End:
@@ -4,6 +4,7 @@
 #include <type_traits>
 #include <utility>
 
+#include "stats.hh"
 #include "util.hh"
 
 enum struct Direction : bool {
@@ -11,10 +12,15 @@ enum struct Direction : bool {
     Back  = false,
 };
 
+template <typename Key, std::size_t N>
+struct SmallRing;
+
 template <typename Key>
 struct Ring {
     using size_type = std::size_t;
 
+    template <typename, std::size_t> friend struct SmallRing;
+
     private:
     struct Node {
         Key   key;
@@ -25,17 +31,31 @@ struct Ring {
             : key  ( k )
             , next { n }
             , prev { p }
-        {}
+        { util::count::transfer<Key const&>(); }
 
         Node(Key&& k, Node* n, Node* p)
             : key  ( std::move(k) )
             , next { n }
             , prev { p }
-        {}
+        { util::count::transfer<Key&&>(); }
 
         Node(Key const& k) : Node { k, this, this } {}
         Node(Key&& k) : Node { std::move(k), this, this } {}
 
+        static auto operator new(std::size_t size) -> void* {
+            util::count::alloc();
+            return ::operator new(size);
+        }
+
+        static auto operator new(std::size_t, void* place) -> void* {
+            return place;
+        }
+
+        static auto operator delete(void* p) -> void {
+            util::count::free();
+            ::operator delete(p);
+        }
+
         auto pop() -> Node* {
             prev->next = next;
             next->prev = prev;
@@ -168,6 +188,7 @@ struct Ring {
         auto operator *() const -> reference { return (*inner).key; }
 
         friend class Ring;
+        template <typename, std::size_t> friend struct SmallRing;
         private:
         typename Node::template IteratorImpl<Transform> inner;
     };
@@ -239,6 +260,7 @@ struct Ring {
     auto find(F const& f) -> Iterator {
         auto it = begin();
         for (; it != end(); ++it) {
+            util::count::visit();
             if (f(it)) { break; }
         }
         return it;
@@ -248,6 +270,7 @@ struct Ring {
     auto find(F const& f) const -> ConstIterator {
         auto it = begin();
         for (; it != end(); ++it) {
+            util::count::visit();
             if (f(it)) { break; }
         }
         return it;
@@ -321,6 +344,7 @@ struct Ring {
     static auto pop(Iterator const& pos) -> Key {
         auto* del = pos.inner.current->pop();
         auto ret = del->key;
+        util::count::transfer<Key const&>();
         delete del;
         return ret;
     }
@@ -5,6 +5,7 @@
 #include <iostream>
 #include <type_traits>
 
+#include "stats.hh"
 #include "util.hh"
 
 /** @file sequence.hpp */
@@ -23,38 +24,55 @@ struct Sequence {
         Node(Key_&& k, Info_&& i)
             : elem_ { std::forward<Key_>(k), std::forward<Info_>(i) }
             , next_ {}
-        {}
+        { util::count::transfer<Key_, Info_>(); }
 
         Node(Elem const& elem)
             : elem_ { elem }
             , next_ {}
-        {}
+        { util::count::transfer<Elem const&>(); }
 
         Node(Elem&& elem)
             : elem_ { std::move(elem) }
             , next_ {}
-        {}
+        { util::count::transfer<Elem&&>(); }
 
         template <typename Key_, typename Info_, typename... Ts>
         Node(Key_&& k, Info_&& i, Ts&&... vs)
             : elem_ { std::forward<Key_>(k), std::forward<Info_>(i) }
             , next_ { util::make_owning<Node>(std::forward<Ts>(vs)...) }
-        {}
+        { util::count::transfer<Key_, Info_>(); }
 
         template <typename... Ts>
         Node(Elem const& elem, Ts&&... vs)
             : elem_ { elem }
             , next_ { util::make_owning<Node>(std::forward<Ts>(vs)...) }
-        {}
+        { util::count::transfer<Elem const&>(); }
 
         template <typename... Ts>
         Node(Elem&& elem, Ts&&... vs)
             : elem_ { std::move(elem) }
             , next_ { util::make_owning<Node>(std::forward<Ts>(vs)...) }
-        {}
+        { util::count::transfer<Elem&&>(); }
 
-        Node(Node const&) = default;
-        Node(Node&&)      = default;
+        Node(Node const& other)
+            : elem_ { other.elem_ }
+            , next_ { other.next_ }
+        { util::count::transfer<Elem const&>(); }
+
+        Node(Node&& other)
+            : elem_ { std::move(other.elem_) }
+            , next_ { std::move(other.next_) }
+        { util::count::transfer<Elem&&>(); }
+
+        static auto operator new(std::size_t size) -> void* {
+            util::count::alloc();
+            return ::operator new(size);
+        }
+
+        static auto operator delete(void* p) -> void {
+            util::count::free();
+            ::operator delete(p);
+        }
 
         auto print() const -> void {
             std::cout << elem_.first << ", " << elem_.second;
@@ -130,6 +148,7 @@ struct Sequence {
         assert(!empty() && "using last on empty list");
         auto node = std::cref(head_);
         while (node.get()->next()) {
+            util::count::visit();
             node = node.get()->next();
         }
         return *node.get();
@@ -185,6 +204,7 @@ struct Sequence {
     auto popf() -> typename Node::Elem {
         assert(!empty() && "popf on empty sequence");
         auto ret = head_->elem();
+        util::count::transfer<typename Node::Elem const&>();
         head_.reset(head_->next().release());
         return ret;
     }
@@ -197,9 +217,11 @@ struct Sequence {
         assert(!empty() && "popb on empty sequence");
         auto node = std::ref(head_);
         while (node.get()->next()) {
+            util::count::visit();
             node = node.get()->next();
         }
         auto ret = node.get()->elem();
+        util::count::transfer<typename Node::Elem const&>();
         node.get().reset();
         return ret;
     }
@@ -296,6 +318,7 @@ struct Sequence {
     auto get_iter_by(F const& func) -> Iterator {
         auto it = begin();
         for (; it != end(); ++it) {
+            util::count::visit();
             if (func(*it)) { break; }
         }
         return it;
@@ -309,6 +332,7 @@ struct Sequence {
     auto get_iter_by(F const& func) const -> ConstIterator {
         auto it = begin();
         for (; it != end(); ++it) {
+            util::count::visit();
             if (func(*it)) { break; }
         }
         return it;
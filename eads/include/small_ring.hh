@@ -0,0 +1,425 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "ring.hh"
+
+/** @file small_ring.hh */
+
+/**
+ * @class SmallRing
+ * Ring keeping its first N nodes in inline storage. only nodes above N are
+ * allocated on the heap, so rings that never grow past N never allocate.
+ * shares nodes and iterators with Ring, but since nodes may live inside
+ * of the object, rotate can't be used to exchange elements between rings.
+ */
+template <typename Key, std::size_t N>
+struct SmallRing {
+    static_assert(N > 0, "SmallRing needs room for at least one node");
+
+    using size_type = std::size_t;
+
+    private:
+    using Node = typename Ring<Key>::Node;
+
+    public:
+    using Iterator      = typename Ring<Key>::Iterator;
+    using ConstIterator = typename Ring<Key>::ConstIterator;
+
+    auto begin() & -> Iterator { return Iterator { first_ }; }
+    auto begin() const & -> ConstIterator {
+        return ConstIterator { first_ };
+    }
+    auto end() & -> Iterator { return Iterator { nullptr }; }
+    auto end() const & -> ConstIterator {
+        return ConstIterator { nullptr };
+    }
+
+    SmallRing() = default;
+    ~SmallRing() {
+        clear();
+    }
+
+    SmallRing(SmallRing const& other) {
+        for (auto const& k : other) { insert(k, Direction::Front); }
+    }
+
+    SmallRing(SmallRing&& other) {
+        for (auto& k : other) { insert(std::move(k), Direction::Front); }
+        other.clear();
+    }
+
+    /*
+     * nodes can't be swapped between objects as they may point into
+     * the inline storage, so assignment always relinks key by key
+     */
+    auto operator =(SmallRing const& other) -> SmallRing& {
+        if (this != &other) {
+            clear();
+            for (auto const& k : other) { insert(k, Direction::Front); }
+        }
+        return *this;
+    }
+
+    auto operator =(SmallRing&& other) -> SmallRing& {
+        if (this != &other) {
+            clear();
+            for (auto& k : other) { insert(std::move(k), Direction::Front); }
+            other.clear();
+        }
+        return *this;
+    }
+
+    template <size_type M>
+    SmallRing(Key const (&keys)[M]) {
+        for (auto const& k : keys) { insert(k, Direction::Front); }
+    }
+
+    auto empty() const -> bool { return first_ == nullptr; }
+
+    /**
+     * @return number of nodes that can still be created without allocating
+     */
+    auto inline_available() const -> size_type { return nfree_; }
+
+    auto clear() -> void {
+        if (!first_) { return; }
+        auto* current = first_;
+        do {
+            auto* del = current;
+            current = current->next;
+            destroy(del);
+        } while (current != first_);
+        first_ = nullptr;
+    }
+
+    auto first() & -> Iterator { return Iterator { first_ }; }
+    auto first() const & -> ConstIterator {
+        return ConstIterator { first_ };
+    }
+    auto last() & -> Iterator { return Iterator { first_->prev }; }
+    auto last() const & -> ConstIterator {
+        return ConstIterator { first_->prev };
+    }
+
+    /**
+     * find node with key given by predicate f, return iterator to it
+     * @return iterator given by predicate f
+     */
+    template <typename F>
+    auto find(F const& f) -> Iterator {
+        auto it = begin();
+        for (; it != end(); ++it) {
+            util::count::visit();
+            if (f(it)) { break; }
+        }
+        return it;
+    }
+
+    template <typename F>
+    auto find(F const& f) const -> ConstIterator {
+        auto it = begin();
+        for (; it != end(); ++it) {
+            util::count::visit();
+            if (f(it)) { break; }
+        }
+        return it;
+    }
+
+    auto insert(Key const& k, Direction dir) -> Iterator {
+        return link(create(k), dir);
+    }
+
+    auto insert(Key&& k, Direction dir) -> Iterator {
+        return link(create(std::move(k)), dir);
+    }
+
+    template <size_type M>
+    auto insert(Key const (&keys)[M], Direction dir) -> Iterator {
+        // keys are chained first and the chain linked as a whole, so they
+        // keep their order in either direction, like in Ring
+        auto* chain = create(keys[0]);
+        for (auto it = std::begin(keys) + 1; it != std::end(keys); ++it) {
+            chain->insert(create(*it), Direction::Front);
+        }
+        return link(chain, dir);
+    }
+
+    /**
+     * change which node the ring starts at. pos has to point into this ring.
+     * @return iterator at previous first node
+     */
+    auto rotate(Iterator const& pos) -> Iterator {
+        auto ret = Iterator { first_ };
+        first_ = pos.inner.current;
+        return ret;
+    }
+
+    auto pop(Iterator const& pos) -> Key {
+        auto* del = pos.inner.current;
+        if (del == first_) {
+            first_ = del->next != del ? del->next : nullptr;
+        }
+        del->pop();
+        auto ret = std::move(del->key);
+        util::count::transfer<Key&&>();
+        destroy(del);
+        return ret;
+    }
+
+    static auto swap(SmallRing& a, SmallRing& b) -> void {
+        auto tmp = std::move(a);
+        a = std::move(b);
+        b = std::move(tmp);
+    }
+
+    private:
+    auto link(Node* node, Direction dir) -> Iterator {
+        if (empty()) {
+            return Iterator { first_ = node };
+        } else {
+            return Iterator { first_->insert(node, dir) };
+        }
+    }
+
+    /**
+     * construct node in the first free inline slot, or on heap if all
+     * of them are taken
+     */
+    template <typename K>
+    auto create(K&& k) -> Node* {
+        if (nfree_ == 0) { return new Node { std::forward<K>(k) }; }
+        return new (&pool_[free_[--nfree_]]) Node { std::forward<K>(k) };
+    }
+
+    auto destroy(Node* node) -> void {
+        if (!owns(node)) {
+            delete node;
+            return;
+        }
+        node->~Node();
+        free_[nfree_++] = static_cast<size_type>(
+            reinterpret_cast<Slot*>(node) - pool_
+        );
+    }
+
+    auto owns(Node const* node) const -> bool {
+        auto const* p = reinterpret_cast<Slot const*>(node);
+        return !std::less<Slot const*> {}(p, pool_)
+            &&  std::less<Slot const*> {}(p, pool_ + N);
+    }
+
+    using Slot = std::aligned_storage_t<sizeof(Node), alignof(Node)>;
+
+    static constexpr auto free_slots() -> std::array<size_type, N> {
+        auto ret = std::array<size_type, N> {};
+        for (size_type i = 0; i < N; ++i) { ret[i] = N - 1 - i; }
+        return ret;
+    }
+
+    Node*                    first_ = {};
+    Slot                     pool_[N];
+    std::array<size_type, N> free_  = free_slots();
+    size_type                nfree_ = N;
+};
+
+/**
+ * @class FixedRing
+ * ring of at most N keys stored in place, linked by indices instead of
+ * pointers. never allocates and can be built at compile time:
+ *
+ *  constexpr auto r = FixedRing({ 1, 2, 3, 4, 5 });
+ *
+ * the constructor takes the keys in the same order as Ring's does.
+ */
+template <typename Key, std::size_t N>
+struct FixedRing {
+    static_assert(N > 0, "FixedRing needs room for at least one key");
+
+    using size_type = std::size_t;
+
+    static constexpr auto npos = static_cast<size_type>(-1);
+
+    template <typename Ring_, typename Value>
+    struct IteratorImpl {
+        using difference_type   = size_type;
+        using value_type        = Value;
+        using pointer           = value_type*;
+        using reference         = value_type&;
+        using iterator_category = std::bidirectional_iterator_tag;
+
+        constexpr IteratorImpl(Ring_* ring, size_type current)
+            : ring_ { ring }, current_ { current }, first_ { current } {}
+
+        constexpr auto operator ==(IteratorImpl const& rhs) const -> bool {
+            return current_ == rhs.current_;
+        }
+
+        constexpr auto operator !=(IteratorImpl const& rhs) const -> bool {
+            return current_ != rhs.current_;
+        }
+
+        constexpr auto operator ++() -> IteratorImpl& {
+            auto next = ring_->next_[current_];
+            current_ = next != first_ ? next : npos;
+            return *this;
+        }
+
+        constexpr auto operator ++(int) -> IteratorImpl {
+            auto ret = *this;
+            ++*this;
+            return ret;
+        }
+
+        constexpr auto operator --() -> IteratorImpl& {
+            current_ = current_ != npos
+                ? ring_->prev_[current_]
+                : ring_->prev_[ring_->first_];
+            return *this;
+        }
+
+        constexpr auto operator --(int) -> IteratorImpl {
+            auto ret = *this;
+            --*this;
+            return ret;
+        }
+
+        constexpr auto operator *() const -> reference {
+            return ring_->keys_[current_];
+        }
+
+        friend struct FixedRing;
+        private:
+        Ring_*    ring_;
+        size_type current_;
+        size_type first_;
+    };
+
+    using Iterator      = IteratorImpl<FixedRing, Key>;
+    using ConstIterator = IteratorImpl<FixedRing const, Key const>;
+
+    constexpr auto begin() & -> Iterator { return Iterator { this, first_ }; }
+    constexpr auto begin() const & -> ConstIterator {
+        return ConstIterator { this, first_ };
+    }
+    constexpr auto end() & -> Iterator { return Iterator { this, npos }; }
+    constexpr auto end() const & -> ConstIterator {
+        return ConstIterator { this, npos };
+    }
+
+    constexpr FixedRing(Key const (&keys)[N])
+        : FixedRing { keys, std::make_index_sequence<N> {} } {}
+
+    constexpr auto empty() const -> bool { return first_ == npos; }
+    constexpr auto size() const -> size_type { return size_; }
+    static constexpr auto capacity() -> size_type { return N; }
+
+    constexpr auto first() & -> Iterator { return Iterator { this, first_ }; }
+    constexpr auto first() const & -> ConstIterator {
+        return ConstIterator { this, first_ };
+    }
+    constexpr auto last() & -> Iterator {
+        return Iterator { this, prev_[first_] };
+    }
+    constexpr auto last() const & -> ConstIterator {
+        return ConstIterator { this, prev_[first_] };
+    }
+
+    /**
+     * find node with key given by predicate f, return iterator to it
+     * @return iterator given by predicate f
+     */
+    template <typename F>
+    constexpr auto find(F const& f) -> Iterator {
+        auto it = begin();
+        for (; it != end(); ++it) {
+            if (f(it)) { break; }
+        }
+        return it;
+    }
+
+    template <typename F>
+    constexpr auto find(F const& f) const -> ConstIterator {
+        auto it = begin();
+        for (; it != end(); ++it) {
+            if (f(it)) { break; }
+        }
+        return it;
+    }
+
+    /**
+     * insert key into a slot freed by pop, fires assertion when full.
+     * @return iterator at inserted key
+     */
+    constexpr auto insert(Key const& k, Direction dir) -> Iterator {
+        assert(size_ < N && "insert into full FixedRing");
+        auto slot = free_;
+        free_ = next_[slot];
+        keys_[slot] = k;
+        ++size_;
+
+        if (empty()) {
+            next_[slot] = prev_[slot] = first_ = slot;
+            return Iterator { this, slot };
+        }
+
+        // Front links before first (at the end), Back right after it
+        auto after  = dir == Direction::Front ? first_ : next_[first_];
+        auto before = prev_[after];
+        next_[slot]   = after;
+        prev_[slot]   = before;
+        next_[before] = slot;
+        prev_[after]  = slot;
+        return Iterator { this, slot };
+    }
+
+    /**
+     * change which key the ring starts at. pos has to point into this ring.
+     * @return iterator at previous first key
+     */
+    constexpr auto rotate(Iterator const& pos) -> Iterator {
+        auto ret = Iterator { this, first_ };
+        first_ = pos.current_;
+        return ret;
+    }
+
+    constexpr auto pop(Iterator const& pos) -> Key {
+        auto slot = pos.current_;
+        if (slot == first_) {
+            first_ = next_[slot] != slot ? next_[slot] : npos;
+        }
+        next_[prev_[slot]] = next_[slot];
+        prev_[next_[slot]] = prev_[slot];
+        next_[slot] = free_;
+        free_ = slot;
+        --size_;
+        return keys_[slot];
+    }
+
+    private:
+    template <size_type... I>
+    constexpr FixedRing(Key const (&keys)[N], std::index_sequence<I...>)
+        : keys_  { keys[I]... }
+        , next_  { ((I + 1) % N)... }
+        , prev_  { ((I + N - 1) % N)... }
+        , first_ { 0 }
+        , free_  { npos }
+        , size_  { N }
+    {}
+
+    std::array<Key, N>       keys_;
+    std::array<size_type, N> next_;
+    std::array<size_type, N> prev_;
+    size_type                first_;
+    size_type                free_;
+    size_type                size_;
+};
+
+template <typename Key, std::size_t N>
+FixedRing(Key const (&)[N]) -> FixedRing<Key, N>;
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <type_traits>
+
+/** @file stats.hh */
+
+namespace util {
+/**
+ * @class Stats
+ * counters of work done by eads containers. they are only collected when
+ * compiled with EADS_STATS defined, otherwise every hook in util::count is
+ * empty and the counters stay at zero. counters are kept per thread.
+ */
+struct Stats {
+    std::size_t node_allocs   = 0;
+    std::size_t node_frees    = 0;
+    std::size_t key_copies    = 0;
+    std::size_t key_moves     = 0;
+    std::size_t nodes_visited = 0;
+
+    auto reset() -> void { *this = Stats {}; }
+
+    friend auto operator <<(std::ostream& os, Stats const& s) -> std::ostream& {
+        return os
+            << "node allocs: "   << s.node_allocs
+            << ", node frees: "  << s.node_frees
+            << ", key copies: "  << s.key_copies
+            << ", key moves: "   << s.key_moves
+            << ", nodes visited: " << s.nodes_visited;
+    }
+};
+
+/**
+ * @fn stats
+ * @return counters of the calling thread
+ */
+inline auto stats() -> Stats& {
+    static thread_local auto s = Stats {};
+    return s;
+}
+
+/**
+ * hooks called by the containers
+ */
+namespace count {
+#ifdef EADS_STATS
+inline constexpr bool enabled = true;
+#else
+inline constexpr bool enabled = false;
+#endif
+
+inline auto alloc() -> void {
+    if constexpr (enabled) { ++stats().node_allocs; }
+}
+
+inline auto free() -> void {
+    if constexpr (enabled) { ++stats().node_frees; }
+}
+
+inline auto visit() -> void {
+    if constexpr (enabled) { ++stats().nodes_visited; }
+}
+
+/**
+ * count key stored from values of types Ts, which is a copy if any of
+ * them is an lvalue and a move otherwise
+ */
+template <typename... Ts>
+inline auto transfer() -> void {
+    if constexpr (enabled) {
+        if constexpr ((std::is_lvalue_reference_v<Ts> || ...)) {
+            ++stats().key_copies;
+        } else {
+            ++stats().key_moves;
+        }
+    }
+}
+}
+}
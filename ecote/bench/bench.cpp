@@ -0,0 +1,109 @@
+#define MACROPROCESSOR_NO_MAIN
+#include "../macroprocessor.cpp"
+
+#include <chrono>
+#include <cstdio>
+#include <new>
+
+/*
+ * runs Switch::run over each of the given files, discarding output and
+ * errors, and reports throughput of the best of runs and heap allocations
+ * per #MCALL in the file
+ */
+
+static auto allocations = std::atomic<std::size_t> { 0 };
+
+// gcc sees free of what came from operator new once they are inlined,
+// though here both of them use malloc and free
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc {};
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+std::size_t count_calls(std::filesystem::path const& path) {
+    auto is = std::ifstream(path, std::ios::binary);
+    auto content = std::string(std::istreambuf_iterator<char>(is), {});
+
+    auto calls = std::size_t { 0 };
+    for (auto i = content.find("#MCALL"); i != std::string::npos;
+            i = content.find("#MCALL", i + 1))
+        calls += 1;
+    return calls;
+}
+
+int main(int argc, char* argv[]) try {
+    auto runs = 3;
+    auto prelude_file = static_cast<char const*>(nullptr);
+    auto files = std::vector<char const*> {};
+
+    for (auto i = 1; i < argc; ++i) {
+        auto arg = std::string_view(argv[i]);
+        if (arg == "-r" && i + 1 < argc)
+            runs = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--prelude" && i + 1 < argc)
+            prelude_file = argv[++i];
+        else
+            files.push_back(argv[i]);
+    }
+
+    auto null = NullBuffer {};
+    auto discard = std::ostream(&null);
+    std::cerr.rdbuf(&null);
+
+    auto prelude = std::unique_ptr<Switch> {};
+    if (prelude_file) {
+        prelude = std::make_unique<Switch>(prelude_file, discard);
+        prelude->run();
+    }
+
+    std::printf("%-32s %10s %10s %14s %12s\n",
+                "corpus", "MB", "MB/s", "allocations", "per call");
+
+    for (auto const* file : files) {
+        if (!std::filesystem::exists(file))
+            throw Switch::Exception { Switch::Error::SOURCE_FILE_MISSING };
+
+        auto mb = std::filesystem::file_size(file) / double(1 << 20);
+        auto calls = count_calls(file);
+
+        auto best = std::chrono::duration<double>::max();
+        auto allocated = std::size_t { 0 };
+        for (auto run = 0; run < runs; ++run) {
+            auto before = allocations.load();
+            auto start = std::chrono::steady_clock::now();
+
+            Switch(file, discard, prelude.get()).run();
+
+            best = std::min<std::chrono::duration<double>>(
+                best, std::chrono::steady_clock::now() - start);
+            allocated = allocations.load() - before;
+        }
+
+        std::printf("%-32s %10.1f %10.1f %14zu %12.3f\n",
+                    std::filesystem::path(file).filename().c_str(), mb,
+                    mb / best.count(), allocated,
+                    calls ? double(allocated) / calls : 0.0);
+    }
+} catch (Switch::Exception const& ex) {
+    std::fprintf(stderr, "%s\n", ex.what());
+    return ex.error.code;
+}
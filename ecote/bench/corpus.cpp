@@ -0,0 +1,188 @@
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+
+/*
+ * generates synthetic input for the macroprocessor of a given kind and
+ * size, the same for the same seed:
+ *
+ *  mdefs      - mostly macro definitions, overwriting each other
+ *  mcalls     - a few definitions followed by dense calls
+ *  text       - long lines of free text, with an occasional ##
+ *  arguments  - calls with many arguments, most of them unused
+ *  positions  - short lines with missing macros and parameters, so that
+ *               errors get logged at positions deep into the input
+ *  mixed      - all of the above, interleaved
+ */
+class Corpus {
+public:
+    Corpus(std::ostream& os, std::uint64_t seed) : os(os), random(seed) {}
+
+    void generate(std::string_view kind, std::uint64_t size) {
+        auto each = [&] (auto line) {
+            while (written < size && os)
+                (this->*line)();
+        };
+
+        if (kind == "mdefs") {
+            each(&Corpus::mdef);
+        } else if (kind == "mcalls") {
+            prelude();
+            each(&Corpus::mcall);
+        } else if (kind == "text") {
+            each(&Corpus::text);
+        } else if (kind == "arguments") {
+            prelude();
+            each(&Corpus::arguments);
+        } else if (kind == "positions") {
+            prelude();
+            each(&Corpus::position);
+        } else if (kind == "mixed") {
+            prelude();
+            each(&Corpus::mixed);
+        } else {
+            std::cerr << "unknown corpus kind: " << kind << '\n';
+            std::exit(1);
+        }
+    }
+
+private:
+    static constexpr int MACROS = 64;
+    static constexpr int PARAMETERS = 5;
+
+    std::ostream& os;
+    std::mt19937_64 random;
+    std::uint64_t written = 0;
+    std::string line;
+
+    int uniform(int from, int to) {
+        return std::uniform_int_distribution(from, to)(random);
+    }
+
+    void write() {
+        line.push_back('\n');
+        os << line;
+        written += line.size();
+        line.clear();
+    }
+
+    void word() {
+        static constexpr char letters[] = "abcdefghijklmnopqrstuvwxyz";
+        for (auto i = uniform(2, 9); i > 0; --i)
+            line.push_back(letters[uniform(0, 25)]);
+    }
+
+    void definition(int macro) {
+        line.append("#MDEF m").append(std::to_string(macro));
+        write();
+        for (auto lines = uniform(1, 3); lines > 0; --lines) {
+            for (auto i = 0; i < PARAMETERS; ++i) {
+                word();
+                line.append(" $p").append(std::to_string(i)).push_back(' ');
+            }
+            line.append("$__name $$");
+            write();
+        }
+        line.append("#MEND");
+        write();
+    }
+
+    // every macro defined once, so calls in the rest of the corpus resolve
+    void prelude() {
+        for (auto macro = 0; macro < MACROS; ++macro)
+            definition(macro);
+    }
+
+    void call(int arguments) {
+        line.append("#MCALL m").append(std::to_string(uniform(0, MACROS - 1)));
+        for (auto i = 0; i < arguments; ++i) {
+            line.append(" p").append(std::to_string(i)).push_back('=');
+            word();
+        }
+        write();
+    }
+
+    void mdef() {
+        definition(uniform(0, 4 * MACROS));
+    }
+
+    void mcall() {
+        call(PARAMETERS);
+    }
+
+    void text() {
+        for (auto i = uniform(10, 40); i > 0; --i) {
+            word();
+            line.append(uniform(0, 50) ? " " : " ## ");
+        }
+        write();
+    }
+
+    void arguments() {
+        call(uniform(PARAMETERS, 32));
+    }
+
+    void position() {
+        switch (uniform(0, 3)) {
+        case 0:
+            line.append("#MCALL missing");
+            write();
+            break;
+        case 1:
+            call(uniform(0, PARAMETERS - 1));
+            break;
+        default:
+            word();
+            write();
+        }
+    }
+
+    void mixed() {
+        switch (uniform(0, 9)) {
+        case 0:
+            mdef();
+            break;
+        case 1:
+        case 2:
+        case 3:
+            mcall();
+            break;
+        case 4:
+            arguments();
+            break;
+        case 5:
+            position();
+            break;
+        default:
+            text();
+        }
+    }
+};
+
+// sizes like 512K, 16M or 1G
+std::uint64_t parse_size(std::string_view s) {
+    auto size = std::strtoull(std::string(s).c_str(), nullptr, 10);
+    switch (s.empty() ? '\0' : s.back()) {
+    case 'G': size <<= 10; [[fallthrough]];
+    case 'M': size <<= 10; [[fallthrough]];
+    case 'K': size <<= 10;
+    }
+    return size;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3 || argc > 4) {
+        std::cerr << "usage: corpus kind size [seed]\n";
+        return 1;
+    }
+
+    auto seed = argc == 4 ? std::strtoull(argv[3], nullptr, 10) : 1;
+
+    std::ios::sync_with_stdio(false);
+    Corpus(std::cout, seed).generate(argv[1], parse_size(argv[2]));
+
+    return std::cout ? 0 : 1;
+}
@@ -1,43 +1,468 @@
 #include <algorithm>
+#include <array>
+#include <charconv>
+#include <atomic>
 #include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <exception>
 #include <filesystem>
 #include <fstream>
 #include <functional>
+#include <future>
+#include <iomanip>
 #include <iostream>
 #include <iterator>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <sstream>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <type_traits>
 #include <unordered_map>
 #include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/*
+ * finds bytes of a set 16 or 32 at a time with SSE2 or AVX2, whichever the
+ * cpu supports, or one at a time where neither is available
+ */
+class Scanner {
+public:
+    /*
+     * up to 3 bytes, along with whitespace as isspace sees it in the
+     * C locale, or with anything but whitespace
+     */
+    struct Set {
+        enum Space { NONE, SPACE, NON_SPACE };
+
+        char bytes[3] = {};
+        int size = 0;
+        Space space = NONE;
+
+        static constexpr bool is_space(char c) {
+            return c == ' ' || (c >= '\t' && c <= '\r');
+        }
+
+        constexpr bool contains(char c) const {
+            for (auto i = 0; i < size; ++i)
+                if (c == bytes[i])
+                    return true;
+            return space == SPACE     ? is_space(c)
+                 : space == NON_SPACE ? !is_space(c)
+                 : false;
+        }
+    };
+
+    static constexpr Set of(std::string_view bytes, Set::Space space = Set::NONE) {
+        auto set = Set {};
+        for (auto c : bytes)
+            set.bytes[set.size++] = c;
+        set.space = space;
+        return set;
+    }
+
+    static constexpr Set SPACE     = { {}, 0, Set::SPACE };
+    static constexpr Set NON_SPACE = { {}, 0, Set::NON_SPACE };
+
+    // first byte in set, or end
+    static char const* find(char const* p, char const* end, Set const& set) {
+        return chosen.find(p, end, set);
+    }
+
+    static std::size_t count(char const* p, char const* end, char c) {
+        return chosen.count(p, end, c);
+    }
+
+private:
+    struct Implementation {
+        char const* (*find)(char const*, char const*, Set const&);
+        std::size_t (*count)(char const*, char const*, char);
+    };
+
+    static char const* find_scalar(char const* p, char const* end, Set const& set) {
+        while (p != end && !set.contains(*p))
+            ++p;
+        return p;
+    }
+
+    static std::size_t count_scalar(char const* p, char const* end, char c) {
+        return std::count(p, end, c);
+    }
+
+#if defined(__x86_64__)
+    static char const* find_sse2(char const* p, char const* end, Set const& set) {
+        __m128i bytes[3];
+        for (auto i = 0; i < set.size; ++i)
+            bytes[i] = _mm_set1_epi8(set.bytes[i]);
+        auto const blank = _mm_set1_epi8(' ');
+        auto const tab   = _mm_set1_epi8('\t');
+        auto const range = _mm_set1_epi8('\r' - '\t');
+
+        for (; end - p >= 16; p += 16) {
+            auto v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p));
+            auto found = 0U;
+
+            if (set.space != Set::NONE) {
+                // \t to \r are the only other whitespace, 5 of them in a row
+                auto shifted = _mm_sub_epi8(v, tab);
+                auto space = _mm_or_si128(
+                    _mm_cmpeq_epi8(v, blank),
+                    _mm_cmpeq_epi8(_mm_min_epu8(shifted, range), shifted));
+                found = _mm_movemask_epi8(space);
+                if (set.space == Set::NON_SPACE)
+                    found ^= 0xffff;
+            }
+            for (auto i = 0; i < set.size; ++i)
+                found |= _mm_movemask_epi8(_mm_cmpeq_epi8(v, bytes[i]));
+
+            if (found)
+                return p + __builtin_ctz(found);
+        }
+        return find_scalar(p, end, set);
+    }
+
+    static std::size_t count_sse2(char const* p, char const* end, char c) {
+        auto const needle = _mm_set1_epi8(c);
+        auto n = std::size_t { 0 };
+
+        for (; end - p >= 16; p += 16) {
+            auto v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p));
+            n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)));
+        }
+        return n + count_scalar(p, end, c);
+    }
+
+    __attribute__((target("avx2")))
+    static char const* find_avx2(char const* p, char const* end, Set const& set) {
+        __m256i bytes[3];
+        for (auto i = 0; i < set.size; ++i)
+            bytes[i] = _mm256_set1_epi8(set.bytes[i]);
+        auto const blank = _mm256_set1_epi8(' ');
+        auto const tab   = _mm256_set1_epi8('\t');
+        auto const range = _mm256_set1_epi8('\r' - '\t');
+
+        for (; end - p >= 32; p += 32) {
+            auto v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p));
+            auto found = 0U;
+
+            if (set.space != Set::NONE) {
+                auto shifted = _mm256_sub_epi8(v, tab);
+                auto space = _mm256_or_si256(
+                    _mm256_cmpeq_epi8(v, blank),
+                    _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, range), shifted));
+                found = _mm256_movemask_epi8(space);
+                if (set.space == Set::NON_SPACE)
+                    found = ~found;
+            }
+            for (auto i = 0; i < set.size; ++i)
+                found |= _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, bytes[i]));
+
+            if (found)
+                return p + __builtin_ctz(found);
+        }
+        return find_sse2(p, end, set);
+    }
+
+    __attribute__((target("avx2,popcnt")))
+    static std::size_t count_avx2(char const* p, char const* end, char c) {
+        auto const needle = _mm256_set1_epi8(c);
+        auto n = std::size_t { 0 };
+
+        for (; end - p >= 32; p += 32) {
+            auto v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p));
+            n += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle)));
+        }
+        return n + count_sse2(p, end, c);
+    }
+
+    static Implementation choose() {
+        // runs before main, cpu features may not be known yet
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return { find_avx2, count_avx2 };
+        return { find_sse2, count_sse2 };
+    }
+#else
+    static Implementation choose() {
+        return { find_scalar, count_scalar };
+    }
+#endif
+
+    static inline Implementation const chosen = choose();
+};
+
+/*
+ * discards everything written to it, for output which is only read
+ * for the macros it defines
+ */
+struct NullBuffer : std::streambuf {
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(char const*, std::streamsize n) override { return n; }
+};
+
+/*
+ * writes to a file descriptor through a large buffer. writes which don't
+ * fit into what's left of it go out together with what's buffered in one
+ * writev, without being copied into the buffer first.
+ */
+class FileBuffer : public std::streambuf {
+public:
+    static constexpr std::size_t BUFFER_SIZE = 1 << 20;
+
+    // fd is closed with the buffer if owned
+    explicit FileBuffer(int fd, bool owned = false)
+        : fd(fd)
+        , owned(owned)
+        , buffer(new char[BUFFER_SIZE])
+    {
+        setp(buffer.get(), buffer.get() + BUFFER_SIZE);
+    }
+
+    FileBuffer(FileBuffer const&) = delete;
+    FileBuffer& operator =(FileBuffer const&) = delete;
+
+    ~FileBuffer() override {
+        sync();
+        if (owned && fd >= 0)
+            ::close(fd);
+    }
+
+protected:
+    int overflow(int c) override {
+        if (!write(nullptr, 0))
+            return EOF;
+        if (c != EOF) {
+            *pptr() = static_cast<char>(c);
+            pbump(1);
+        }
+        return c == EOF ? 0 : c;
+    }
+
+    std::streamsize xsputn(char const* s, std::streamsize n) override {
+        if (n <= epptr() - pptr()) {
+            std::memcpy(pptr(), s, n);
+            pbump(static_cast<int>(n));
+            return n;
+        }
+        return write(s, n) ? n : 0;
+    }
+
+    int sync() override {
+        return write(nullptr, 0) ? 0 : -1;
+    }
+
+private:
+    int fd;
+    bool owned;
+    std::unique_ptr<char[]> buffer;
+
+    // buffered data followed by n bytes of s, the buffer is empty after
+    bool write(char const* s, std::size_t n) {
+        iovec iov[] = {
+            { pbase(), static_cast<std::size_t>(pptr() - pbase()) },
+            { const_cast<char*>(s), n },
+        };
+        setp(buffer.get(), buffer.get() + BUFFER_SIZE);
+
+        auto* first = iov;
+        auto* end   = iov + 2;
+        while (first != end) {
+            if (first->iov_len == 0) {
+                ++first;
+                continue;
+            }
+
+            auto written = ::writev(fd, first, static_cast<int>(end - first));
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written < 0)
+                return false;
+
+            for (auto left = static_cast<std::size_t>(written); left > 0; ) {
+                auto step = std::min(left, first->iov_len);
+                first->iov_base = static_cast<char*>(first->iov_base) + step;
+                first->iov_len -= step;
+                left -= step;
+                if (first->iov_len == 0)
+                    ++first;
+            }
+        }
+        return true;
+    }
+};
+
+// collects everything written to it in text
+struct StringBuffer : std::streambuf {
+    std::string text;
+
+    int overflow(int c) override {
+        text.push_back(static_cast<char>(c));
+        return c;
+    }
+
+    std::streamsize xsputn(char const* s, std::streamsize n) override {
+        text.append(s, n);
+        return n;
+    }
+};
 
 class Switch {
 public:
-    Switch(std::string filename, std::istream& is, std::ostream& os)
-        : is(is)
+    /*
+     * macros defined by prelude are visible to this switch too,
+     * prelude is only read and has to outlive it
+     */
+    Switch(std::string filename, std::istream& is, std::ostream& os,
+           Switch const* prelude = nullptr)
+        : reader(is)
         , os(os)
+        , library(prelude ? &prelude->library : nullptr)
         , position(std::move(filename))
-    {}
-
-    void run() try {
-        char c;
-        while (os && get(c)) {
-            if (c == '#')
-                pound();
-            else
-                os << c;
-        }
+    {
+        reader.track(position);
+    }
 
-        if (os.fail())
-            throw Exception { Error::OS_FAIL };
+    // reads file named filename directly, mapping it into memory if possible
+    Switch(std::string filename, std::ostream& os,
+           Switch const* prelude = nullptr)
+        : reader(filename)
+        , os(os)
+        , library(prelude ? &prelude->library : nullptr)
+        , position(std::move(filename))
+    {
+        reader.track(position);
+    }
 
+    void run() try {
+        process();
+        if (stats)
+            stats->report(*diagnostics);
     } catch (Exception const& ex) {
         Error::log(*this, ex.what());
+        // output up to the error is written out, exit won't flush it
+        os.flush();
+        if (stats)
+            stats->report(*diagnostics);
         std::exit(ex.error.code);
     }
 
+    // like run, but fatal errors are thrown instead of exiting
+    void process() {
+        while (os && step())
+            continue;
+
+        if (os.flush().fail())
+            throw Exception { Error::OS_FAIL };
+    }
+
+    /*
+     * like run, but expands input on jobs threads in two phases. first one
+     * only defines macros, to learn which ones are visible where, and splits
+     * input into chunks between directives. second one expands the chunks
+     * in parallel, their output and errors are then written out in order,
+     * the same as run would write them.
+     */
+    void run_parallel(unsigned jobs) {
+        auto input  = std::string_view {};
+        auto layers = std::deque<Library> {};
+        auto chunks = std::vector<Chunk> {};
+        try {
+            input  = reader.rest();
+            reader.count(position.offset);
+            chunks = split(input, layers);
+        } catch (Exception const& ex) {
+            Error::log(*this, ex.what());
+            os.flush();
+            std::exit(ex.error.code);
+        }
+
+        auto results = std::vector<std::promise<Result>>(chunks.size());
+        auto next    = std::atomic<std::size_t> { 0 };
+
+        // anything but Exception, like bad_alloc, is handed to the writer
+        auto work = [&] {
+            for (auto i = next++; i < chunks.size(); i = next++) {
+                try {
+                    results[i].set_value(chunks[i].expand(input, max_body));
+                } catch (...) {
+                    results[i].set_exception(std::current_exception());
+                }
+            }
+        };
+
+        auto threads = std::vector<std::thread> {};
+        jobs = std::min<std::size_t>(jobs, chunks.size());
+        for (auto i = 0U; i < jobs; ++i)
+            threads.emplace_back(work);
+
+        // stops at the first chunk which failed, as run would
+        auto code = 0;
+        auto failure = std::exception_ptr {};
+        for (auto i = 0UL; i < results.size() && !code; ++i) {
+            auto result = Result {};
+            try {
+                result = results[i].get_future().get();
+            } catch (...) {
+                // rethrown once the workers are done
+                failure = std::current_exception();
+                break;
+            }
+            write(result);
+            code = result.code;
+
+            if (!code && !os) {
+                position = chunks[i].position;
+                Error::log(*this, Error::OS_FAIL);
+                code = Error::OS_FAIL;
+            }
+        }
+
+        // chunks nobody claimed yet are skipped
+        next = chunks.size();
+        for (auto& thread : threads)
+            thread.join();
+
+        os.flush();
+        if (failure)
+            std::rethrow_exception(failure);
+        if (code)
+            std::exit(code);
+    }
+
+    /*
+     * input is a library written by dump, its macros are taken as they
+     * are instead of processing it. they refer to the input, which is
+     * usually mapped into memory, for as long as the switch lives.
+     */
+    void load() {
+        library.load(reader.rest());
+    }
+
+    // every macro visible to this switch, compiled, for load
+    void dump(std::ostream& os) const {
+        library.dump(os);
+        if (!os.flush())
+            throw Exception { Error::OS_FAIL };
+    }
+
     struct Error {
         enum Code {
             IS_FAIL = 1,
@@ -49,13 +474,24 @@ public:
             MACRO_MISSING_NAME,
             MACRO_MISSING_DEFINITION,
             CORRESPONDING_MDEF,
+            USAGE,
+            BATCH_ARGUMENTS,
+            LIBRARY_FILE,
+            MACRO_BODY_SIZE,
+            MFOR_MISSING_PARAMETER,
+            DEPENDENCIES_FILE,
             OTHER,
         } code;
-        char const* const message;
+        char const* message;
 
 #pragma GCC diagnostic push
+#ifdef __clang__
 #pragma GCC diagnostic ignored "-Wc99-designator"
+#endif
         static constexpr char const* MESSAGES[] = {
+            // 0 is success, it has no message
+            [0] =
+                nullptr,
             [IS_FAIL] =
                 "input stream error has occurred",
             [OS_FAIL] =
@@ -67,13 +503,29 @@ public:
             [POUND_FREE_TEXT] =
                 "# should be followed by #, MDEF, or MCALL",
             [POUND_MACRO_BODY] =
-                "# in macro body should be followed by #, or MEND",
+                "# in macro body should be followed by "
+                "#, MCALL, MIF, MELSE, MFOR, or MEND",
             [MACRO_MISSING_NAME] =
                 "missing macro name",
             [MACRO_MISSING_DEFINITION] =
                 "missing macro definition",
             [CORRESPONDING_MDEF] =
                 "#MEND without corresponding #MDEF",
+            [USAGE] =
+                "usage: macroprocessor [-j jobs] [--parallel] [--incremental] "
+                "[--prelude file] [--library file] [--dump-library file] "
+                "[--stats text|json] [--max-body size] "
+                "[source [target] [source target]...]",
+            [BATCH_ARGUMENTS] =
+                "sources and targets should come in pairs",
+            [LIBRARY_FILE] =
+                "invalid library file",
+            [MACRO_BODY_SIZE] =
+                "macro body is too large, skipped up to #MEND",
+            [MFOR_MISSING_PARAMETER] =
+                "#MFOR should be followed by a parameter on its line",
+            [DEPENDENCIES_FILE] =
+                "dependencies of target couldn't be saved",
         };
 #pragma GCC diagnostic pop
 
@@ -93,8 +545,15 @@ public:
 
         template<class... Args>
         static void log(Switch& sw, Args&&... args) {
+            // switches running in parallel shouldn't interleave their lines
+            static auto mutex = std::mutex {};
+            auto lock = std::lock_guard { mutex };
+            sw.errors += 1;
+            sw.reader.count(sw.position.offset);
+            // output is buffered, the error has to come after what preceded it
+            sw.os.flush();
             (
-                (std::cerr << sw.position << ' ')
+                (*sw.diagnostics << sw.position << ' ')
                 << ...
                 << std::forward<decltype(args)>(args)
             ) << '\n';
@@ -110,21 +569,202 @@ public:
         }
     };
 
+    /*
+     * what output of a file depends on besides the file itself, macros
+     * it called from elsewhere (from prelude) by hashes of their bodies,
+     * 0 for missing ones. macros the file defined are kept for reference.
+     */
+    struct Dependencies {
+        std::uint64_t source = 0;
+        std::uint64_t options = 0;   // which change output, 0 in version 1
+        std::map<std::string, std::uint64_t> called = {};
+        std::map<std::string, std::uint64_t> defined = {};
+
+        bool load(std::filesystem::path const& path) {
+            auto is = std::ifstream(path);
+            auto tag = std::string {};
+            auto version = 0;
+            if (!(is >> tag >> version) || tag != "ecote-deps" || version < 1 || version > 2)
+                return false;
+
+            auto kind = std::string {};
+            auto name = std::string {};
+            auto hash = std::uint64_t { 0 };
+            while (is >> kind) {
+                if (kind == "source" && is >> std::hex >> source >> std::dec)
+                    continue;
+                if (kind == "options" && is >> std::hex >> options >> std::dec)
+                    continue;
+                if (!(is >> name >> std::hex >> hash >> std::dec))
+                    return false;
+                if (kind == "called")
+                    called.emplace(name, hash);
+                else if (kind == "defined")
+                    defined.emplace(name, hash);
+                else
+                    return false;
+            }
+            return is.eof();
+        }
+
+        bool save(std::filesystem::path const& path) const {
+            auto os = std::ofstream(path);
+            os << "ecote-deps 2\n" << std::hex
+               << "source " << source << '\n'
+               << "options " << options << '\n';
+            for (auto const& [name, hash] : called)
+                os << "called " << name << ' ' << hash << '\n';
+            for (auto const& [name, hash] : defined)
+                os << "defined " << name << ' ' << hash << '\n';
+            return static_cast<bool>(os.flush());
+        }
+
+        // whether macros called from elsewhere are still the same
+        bool current(Switch const* prelude) const {
+            for (auto const& [name, hash] : called) {
+                auto const* macro = prelude ? prelude->library.find(name) : nullptr;
+                if ((macro ? macro->hash : 0) != hash)
+                    return false;
+            }
+            return true;
+        }
+    };
+
+    // when set, what the input depends on is recorded into it
+    Dependencies* dependencies = nullptr;
+
+    /*
+     * cost of expanding each macro by name. bytes and time of a call
+     * include those of calls nested in it, so they add up to more than
+     * the output when macros call each other. #MIF and #MFOR in free
+     * text aren't macros, only calls made from them are counted.
+     */
+    struct Stats {
+        struct Usage {
+            std::size_t calls = 0;
+            std::size_t bytes = 0;     // expanded
+            std::size_t lookups = 0;   // of parameters among arguments
+            std::size_t missing = 0;   // parameters
+            std::chrono::steady_clock::duration time = {};
+        };
+
+        std::map<std::string, Usage, std::less<>> macros = {};
+        bool json = false;
+
+        Usage& operator[](std::string_view name) {
+            auto it = macros.find(name);
+            if (it == macros.end())
+                it = macros.emplace(name, Usage {}).first;
+            return it->second;
+        }
+
+        // the most expensive macros first
+        void report(std::ostream& os) const {
+            using Entry = std::pair<std::string const, Usage> const*;
+            auto sorted = std::vector<Entry> {};
+            for (auto const& entry : macros)
+                sorted.push_back(&entry);
+            std::stable_sort(sorted.begin(), sorted.end(), [] (Entry a, Entry b) {
+                return a->second.time > b->second.time;
+            });
+
+            auto ns = [] (Usage const& usage) {
+                return std::chrono::duration_cast<std::chrono::nanoseconds>(usage.time).count();
+            };
+
+            if (json) {
+                os << "{\"macros\":[";
+                for (auto const* entry : sorted) {
+                    auto const& [name, usage] = *entry;
+                    os << (entry == sorted.front() ? "" : ",") << "{\"name\":\"";
+                    for (auto c : name) {
+                        if (c == '"' || c == '\\')
+                            os << '\\' << c;
+                        else if (static_cast<unsigned char>(c) < 0x20)
+                            os << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+                               << int(c) << std::dec << std::setfill(' ');
+                        else
+                            os << c;
+                    }
+                    os << "\",\"calls\":" << usage.calls
+                       << ",\"bytes\":" << usage.bytes
+                       << ",\"lookups\":" << usage.lookups
+                       << ",\"missing\":" << usage.missing
+                       << ",\"time_ns\":" << ns(usage) << '}';
+                }
+                os << "]}" << std::endl;
+                return;
+            }
+
+            os << std::left << std::setw(24) << "macro" << std::right
+               << std::setw(12) << "calls" << std::setw(14) << "bytes"
+               << std::setw(12) << "lookups" << std::setw(10) << "missing"
+               << std::setw(12) << "time ms" << '\n';
+            for (auto const* entry : sorted) {
+                auto const& [name, usage] = *entry;
+                os << std::left << std::setw(24) << name << std::right
+                   << std::setw(12) << usage.calls << std::setw(14) << usage.bytes
+                   << std::setw(12) << usage.lookups << std::setw(10) << usage.missing
+                   << std::setw(12) << std::fixed << std::setprecision(3)
+                   << ns(usage) / 1e6 << '\n';
+            }
+            os.flush();
+        }
+    };
+
+    // when set, run reports what expanding each macro cost
+    Stats* stats = nullptr;
+
+    // larger macro bodies are reported and skipped
+    static constexpr std::size_t MAX_BODY = std::size_t { 1 } << 28;
+    std::size_t max_body = MAX_BODY;
+
+    // whether no error was logged, not even one that wasn't fatal
+    bool clean() const {
+        return errors == 0;
+    }
+
+    // FNV-1a, for telling apart versions of sources and macros
+    static std::uint64_t digest(std::string_view s,
+                                std::uint64_t hash = 14695981039346656037ULL) {
+        for (auto c : s)
+            hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+        return hash;
+    }
+
 private:
+    /*
+     * only offset is kept up with input as it's read, line and column are
+     * counted from input only when an error is reported, or before reader
+     * drops input they weren't counted in yet
+     */
     struct Position {
         Position(std::string filename) : filename(std::move(filename)) {}
         std::string filename;
+        std::size_t offset = 0;
+
+        // line and column at counted
+        std::size_t counted = 0;
         int line = 1, column = 0;
 
-        std::istream& get(std::istream& is, char& c) {
-            is.get(c);
-            if (c == '\n') {
-                line += 1;
-                column = 0;
+        void advance(char) {
+            offset += 1;
+        }
+
+        void advance(std::string_view text) {
+            offset += text.size();
+        }
+
+        // text is input following counted
+        void count(std::string_view text) {
+            auto newlines = Scanner::count(text.data(), text.data() + text.size(), '\n');
+            if (newlines) {
+                line  += static_cast<int>(newlines);
+                column = static_cast<int>(text.size() - 1 - text.rfind('\n'));
             } else {
-                column += 1;
+                column += static_cast<int>(text.size());
             }
-            return is;
+            counted += text.size();
         }
 
         friend std::ostream& operator <<(std::ostream& os,
@@ -138,237 +778,2187 @@ private:
         }
     };
 
-    class Arguments {
-        std::map<std::string, std::string> _;
-
+    /*
+     * hands out input read in large blocks, or mapped into memory, so that
+     * free text can be scanned for # with memchr instead of char by char
+     */
+    class Reader {
     public:
-        static Arguments read(Switch& sw) {
-            auto arguments = Arguments {};
-            auto& is = sw.is;
-            char c;
+        static constexpr std::size_t BLOCK_SIZE = 1 << 16;
 
-            while (is.peek() != '\n') {
-                while (std::isspace(is.peek()) && sw.get(c) && c != '\n')
-                    continue;
+        Reader(std::istream& is) : is(&is), buffer(BLOCK_SIZE) {}
 
-                auto argument = sw.get_word();
-                auto position = argument.find("=");
+        /*
+         * input handed over by feed, running out of it before finish
+         * throws Incomplete, so that what was being read can be retried
+         * once there's more of it
+         */
+        struct Incomplete {};
 
-                arguments._.insert_or_assign(
-                    argument.substr(0, position),
-                    argument.substr(position + 1)
-                );
-            }
+        Reader() : feeding(true) {}
 
-            // ignore following newline
-            is.get(c);
+        // input already in memory, which has to outlive the reader
+        Reader(std::string_view input)
+            : first(input.data())
+            , current(input.data())
+            , last(input.data() + input.size())
+        {}
 
-            return arguments;
+        Reader(std::string const& path) {
+            if (map(path))
+                return;
+            owned  = std::make_unique<std::ifstream>(path, std::ios::binary);
+            is     = owned.get();
+            buffer.resize(BLOCK_SIZE);
         }
 
-        bool contains(std::string const& key) const {
-            return _.find(key) != _.end();
+        Reader(Reader const&) = delete;
+        Reader& operator =(Reader const&) = delete;
+
+        ~Reader() {
+            if (mapping)
+                ::munmap(mapping, length);
         }
 
-        std::string get(Switch& sw, std::string const& key) const {
-            if (contains(key)) {
-                return _.at(key);
-            } else {
-                Error::log(sw, "missing parameter '", key, "'");
-                return "";
-            }
+        int peek() {
+            if (current == last && !refill())
+                return EOF;
+            return static_cast<unsigned char>(*current);
         }
 
-        friend std::ostream& operator <<(std::ostream& os, Arguments const& args) {
-            auto const* delim = "";
+        bool get(char& c) {
+            if (current == last && !refill())
+                return false;
+            c = *current++;
+            return true;
+        }
 
-            for (auto const& [key, value] : args._)
-                os << key << ": " << value << std::exchange(delim, ", ");
+        // consume input up to delim, or up to the end of what's buffered
+        std::string_view until(char delim) {
+            if (current == last && !refill())
+                return {};
+
+            auto const* found = static_cast<char const*>(
+                std::memchr(current, delim, last - current));
+            auto const* stop  = found ? found : last;
+            auto span = std::string_view(current, stop - current);
+            current = stop;
+            return span;
+        }
 
-            return os << '\n';
+        // consume input up to a byte of set, or up to the end of what's buffered
+        std::string_view until(Scanner::Set const& set) {
+            if (current == last && !refill())
+                return {};
+
+            auto const* stop = Scanner::find(current, last, set);
+            auto span = std::string_view(current, stop - current);
+            current = stop;
+            return span;
         }
-    };
 
-    struct Macro {
-        std::string name, body;
+        /*
+         * input from here on is kept in the buffer until released,
+         * release returns all of it
+         */
+        void hold() {
+            held_ = current;
+        }
 
-        static Macro read(Switch& sw) {
-            return Macro {
-                read_name(sw),
-                read_body(sw)
-            };
+        std::string_view held() const {
+            return { held_, static_cast<std::size_t>(current - held_) };
         }
 
-        void expand(Switch& sw, Arguments const& args) {
-            auto ss = std::stringstream { body };
-            char c;
+        std::string_view release() {
+            auto held = this->held();
+            held_ = nullptr;
+            return held;
+        }
 
-             while (sw.os && ss.get(c)) {
-                 if (c != '$') {
-                     sw.os.put(c);
-                 } else {
-                     auto parameter = std::string {};
+        // position whose lines are counted in input before it is dropped
+        void track(Position& position) {
+            this->position = &position;
+            base = position.offset;
+        }
 
-                     while (!std::isspace(ss.peek()) && ss.get(c))
-                         parameter.push_back(c);
+        // counts lines of position up to offset, which has to be in memory
+        void count(std::size_t offset) {
+            if (!position || position->counted >= offset)
+                return;
+            auto const* from = first + (position->counted - base);
+            position->count({ from, offset - position->counted });
+        }
 
-                     if (parameter == "$")
-                         sw.os.put('$');
-                     else if (parameter == "__name")
-                         sw.os << name;
-                     else
-                         sw.os << args.get(sw, parameter);
-                 }
-             }
+        /*
+         * input up to current is dropped, what follows is appended. false
+         * while what's awaited hasn't arrived, so there's no use reading on.
+         */
+        bool feed(std::string_view input) {
+            drop(current);
+            auto from = current ? static_cast<std::size_t>(current - buffer.data()) : 0;
+            auto kept = static_cast<std::size_t>(last - current);
+
+            // kept input is moved to front only once there's at least as much
+            // dropped before it, otherwise the buffer grows to twice its size
+            if (from && from >= kept) {
+                std::memmove(buffer.data(), current, kept);
+                from = 0;
+            }
+            if (buffer.size() < from + kept + input.size())
+                buffer.resize(std::max(2 * buffer.size(), from + kept + input.size()));
+            if (!input.empty())
+                std::memcpy(buffer.data() + from + kept, input.data(), input.size());
+
+            first   = buffer.data() + from;
+            current = first;
+            last    = current + kept + input.size();
+
+            if (awaited.empty())
+                return true;
+
+            // kept input was all read, only its end can be part of awaited
+            auto overlap = std::min(kept, awaited.size() - 1);
+            auto fresh = std::string_view(current + kept - overlap, overlap + input.size());
+            if (fresh.find(awaited) == fresh.npos)
+                return false;
+            awaited = {};
+            return true;
         }
 
-        static std::string read_name(Switch& sw) {
-            sw.ignore_whitespace();
-            auto word = sw.get_word();
-            if (word == "#MEND")
-                throw Exception { Error::MACRO_MISSING_NAME };
-            return word;
+        /*
+         * what has to be fed before reading that ran out of input can get
+         * any further, empty when any input will do
+         */
+        void await(std::string_view what) {
+            awaited = what;
         }
 
-        static std::string read_body(Switch& sw) {
-            auto body = std::string {};
-            char c;
+        void finish() {
+            finished = true;
+            awaited  = {};
+        }
 
-            auto& is = sw.is;
+        void reset() {
+            first = current = last = held_ = nullptr;
+            base = position ? position->offset : 0;
+            finished = false;
+            awaited  = {};
+        }
 
-            // ignore any leading whitespace, newline begins macro body
-            while (std::isspace(is.peek()) && sw.get(c))
-                if (c == '\n')
-                    break;
+        char const* mark() const {
+            return current;
+        }
 
-            while (sw.get(c)) {
-                if (c != '#') {
-                    body.push_back(c);
-                } else {
-                    auto command = sw.get_word();
+        // back to a mark taken since the last feed
+        void rewind(char const* mark) {
+            current = mark;
+            held_   = nullptr;
+        }
 
-                    if (command == "#")
-                        body.push_back('#');
-                    else if (command == "MEND")
-                        break;
-                    else
-                        Error::log(sw, Error::POUND_MACRO_BODY);
-                }
+        // rest of the input, all of it read into memory
+        std::string_view rest() {
+            if (is && (current != last || refill())) {
+                auto const* keep = current;
+                while (refill(keep))
+                    continue;
+                first   = keep;
+                current = keep;
+                is      = nullptr;
             }
+            return { current, static_cast<std::size_t>(last - current) };
+        }
 
-            // ignore trainling newline (?)
-            sw.get(c);
+        // offset into input held in memory, by rest or a mapping
+        std::size_t offset() const {
+            return current - first;
+        }
 
-            return body;
+        // consume input up to whitespace, keeping it contiguous in the buffer
+        std::string_view until_space() {
+            auto const* start = current;
+
+            while (true) {
+                current = Scanner::find(current, last, Scanner::SPACE);
+                if (current != last || !refill(start))
+                    break;
+            }
+
+            return { start, static_cast<std::size_t>(current - start) };
         }
-    };
 
+    private:
+        std::istream* is = nullptr;
+        std::unique_ptr<std::istream> owned;
+        std::vector<char> buffer;
 
-    std::istream& is;
-    std::ostream& os;
+        void* mapping = nullptr;
+        std::size_t length = 0;
 
-    class Library {
-        std::unordered_map<std::string, std::string> _;
+        char const* first   = nullptr;
+        char const* current = nullptr;
+        char const* last    = nullptr;
+        char const* held_   = nullptr;
 
-    public:
-        bool contains(std::string const& name) const {
-            return _.find(name) != _.end();
+        // offset of input at first, for position
+        Position* position = nullptr;
+        std::size_t base = 0;
+
+        bool feeding  = false;
+        bool finished = false;
+        std::string_view awaited;
+
+        bool refill() {
+            char const* keep = nullptr;
+            return refill(keep);
         }
 
-        void add(Switch& sw, Macro macro) {
-            if (contains(macro.name))
-                Error::log(sw, "overwriting macro '", macro.name, "'");
-            _.insert_or_assign(std::move(macro.name), std::move(macro.body));
+        // input before p is about to be dropped, its lines are counted first
+        void drop(char const* p) {
+            auto offset = base + (p - first);
+            count(offset);
+            base  = offset;
+            first = p;
         }
 
-        Macro get(Switch& sw, std::string const& name) const {
-            if (contains(name)) {
-                return Macro { name, _.at(name) };
-            } else {
-                Error::log(sw, "missing macro definition: '", name, "'");
-                return Macro { name, "" };
-            }
+        /*
+         * read next block, moving input from keep, or from what's held
+         * if it starts earlier, on to front of the buffer
+         */
+        bool refill(char const*& keep) {
+            if (feeding && !finished)
+                throw Incomplete {};
+            if (!is)
+                return false;
+
+            auto const* start = held_ ? held_ : keep;
+            drop(start ? start : last);
+
+            auto from = start ? start - buffer.data() : 0;
+            auto kept = start ? static_cast<std::size_t>(last - start) : 0;
+            auto keep_at = keep ? keep - start : 0;
+            if (kept == buffer.size())
+                buffer.resize(2 * buffer.size());
+            if (kept && from)
+                std::memmove(buffer.data(), buffer.data() + from, kept);
+            if (held_)
+                held_ = buffer.data();
+            if (keep)
+                keep = buffer.data() + keep_at;
+
+            is->read(buffer.data() + kept, buffer.size() - kept);
+            if (is->bad())
+                throw Exception { Error::IS_FAIL };
+
+            first   = buffer.data();
+            current = buffer.data() + kept;
+            last    = current + is->gcount();
+            return is->gcount() != 0;
         }
 
-    } library = {};
+        bool map(std::string const& path) {
+            auto fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                return false;
 
-    Position position;
+            struct stat st;
+            if (::fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+                ::close(fd);
+                return false;
+            }
 
-    void pound() {
-        auto command = get_word();
+            length = st.st_size;
+            if (length > 0) {
+                mapping = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapping == MAP_FAILED) {
+                    mapping = nullptr;
+                    length  = 0;
+                    ::close(fd);
+                    return false;
+                }
+                ::madvise(mapping, length, MADV_SEQUENTIAL);
+                first   = static_cast<char const*>(mapping);
+                current = first;
+                last    = current + length;
+            }
 
-        if (command == "#")
-            os << '#';
-        else if (command == "MDEF")
-            macro_def();
-        else if (command == "MCALL")
-            macro_call();
-        else if (command == "MEND")
-            Error::log(*this, Error::CORRESPONDING_MDEF);
-        else
-            Error::log(*this, Error::POUND_FREE_TEXT);
-    }
+            ::close(fd);
+            return true;
+        }
+    };
 
-    void macro_def() try {
-        library.add(*this, Macro::read(*this));
-    } catch (Exception const& ex) {
-        Error::log(*this, ex.what());
-    }
+    /*
+     * vector keeping its first N elements inline, for the few arguments
+     * and parameters of a call, so that a call doesn't have to allocate
+     */
+    template<class T, std::size_t N>
+    class SmallVector {
+        std::array<T, N> inline_ = {};
+        std::vector<T> heap;
+        std::size_t count = 0;
 
-    void macro_call() {
-        library
-            .get(*this, Macro::read_name(*this))
-            .expand(*this, Arguments::read(*this));
-    }
+    public:
+        SmallVector() = default;
 
-    bool get(char& c) {
-        position.get(is, c);
+        explicit SmallVector(std::size_t size) {
+            if (size > N)
+                heap.resize(size);
+            count = size;
+        }
 
-        if (is.fail() && !is.eof())
-            throw Exception { Error::IS_FAIL };
+        void push_back(T t) {
+            if (count == N)
+                heap.assign(inline_.begin(), inline_.end());
+            if (count < N)
+                inline_[count] = std::move(t);
+            else
+                heap.push_back(std::move(t));
+            count += 1;
+        }
 
-        return is.good();
-    }
+        std::size_t size() const { return count; }
 
-    void ignore_whitespace() {
-        char c;
-        while (std::isspace(is.peek()) && get(c))
-            continue;
-    }
+        T* begin() { return count > N ? heap.data() : inline_.data(); }
+        T* end() { return begin() + count; }
+        T const* begin() const { return count > N ? heap.data() : inline_.data(); }
+        T const* end() const { return begin() + count; }
 
-    std::string get_word() {
-        char c;
-        auto word = std::string {};
+        T& operator [](std::size_t i) { return begin()[i]; }
+        T const& operator [](std::size_t i) const { return begin()[i]; }
+    };
 
-        while (!std::isspace(is.peek()) && get(c))
-            word.push_back(c);
+    /*
+     * arguments of a call as views into the input, or into the line of
+     * a nested call, valid only until it's read further
+     */
+    class Arguments {
+        struct Argument {
+            std::string_view key, value;
+        };
 
+        SmallVector<Argument, 8> _;
+
+    public:
+        static Arguments read(Switch& sw) {
+            auto arguments = Arguments {};
+            char c;
+
+            // reading on may move what was read in the buffer, so words are
+            // kept as offsets until the whole call has been read
+            auto words = SmallVector<std::pair<std::size_t, std::size_t>, 8> {};
+            sw.reader.hold();
+            sw.reader.await("\n");
+
+            // whitespace up to and with a newline
+            static constexpr auto blank = Scanner::of("\n", Scanner::Set::NON_SPACE);
+
+            while (sw.peek() != '\n' && sw.peek() != EOF) {
+                sw.skip(blank);
+                if (sw.peek() == '\n')
+                    sw.get(c);
+
+                auto word = sw.get_word();
+                auto offset = word.data() - sw.reader.held().data();
+                words.push_back({ offset, word.size() });
+            }
+
+            auto call = sw.reader.release();
+            sw.reader.await({});
+            for (auto [offset, size] : words)
+                arguments.add(call.substr(offset, size));
+
+            return arguments;
+        }
+
+        // arguments of a call nested in a macro body, after its expansion
+        static Arguments parse(std::string_view line) {
+            auto arguments = Arguments {};
+            auto i = std::size_t { 0 };
+
+            auto const* data = line.data();
+            auto const* last = data + line.size();
+
+            while (i < line.size()) {
+                i = Scanner::find(data + i, last, Scanner::NON_SPACE) - data;
+                auto end = Scanner::find(data + i, last, Scanner::SPACE) - data;
+
+                arguments.add(line.substr(i, end - i));
+                i = end;
+            }
+
+            return arguments;
+        }
+
+        bool contains(std::string_view key) const {
+            return find(key) != nullptr;
+        }
+
+        // later arguments override earlier ones with the same key
+        std::string_view const* find(std::string_view key) const {
+            for (auto it = _.end(); it != _.begin(); --it)
+                if (it[-1].key == key)
+                    return &it[-1].value;
+            return nullptr;
+        }
+
+        friend std::ostream& operator <<(std::ostream& os, Arguments const& args) {
+            auto const* delim = "";
+
+            for (auto const& [key, value] : args._)
+                os << key << ": " << value << std::exchange(delim, ", ");
+
+            return os << '\n';
+        }
+
+    private:
+        // key=value, or just a key standing for itself
+        void add(std::string_view argument) {
+            auto position = argument.find("=");
+            _.push_back({
+                argument.substr(0, position),
+                argument.substr(position + 1)
+            });
+        }
+    };
+
+    /*
+     * storage for macro names and bodies, grown in large blocks so that
+     * views into it stay valid for as long as the arena lives
+     */
+    class Arena {
+    public:
+        static constexpr std::size_t BLOCK_SIZE = 1 << 16;
+
+        std::string_view store(std::string_view s) {
+            if (s.empty())
+                return {};
+
+            // big strings get a block of their own, so the current one
+            // isn't abandoned half empty
+            if (s.size() > BLOCK_SIZE / 4)
+                return copy(allocate(s.size()), s);
+
+            if (s.size() > left) {
+                free = allocate(BLOCK_SIZE);
+                left = BLOCK_SIZE;
+            }
+
+            auto stored = copy(free, s);
+            free += s.size();
+            left -= s.size();
+            return stored;
+        }
+
+    private:
+        std::vector<std::unique_ptr<char[]>> blocks;
+        char* free = nullptr;
+        std::size_t left = 0;
+
+        char* allocate(std::size_t size) {
+            blocks.emplace_back(new char[size]);
+            return blocks.back().get();
+        }
+
+        static std::string_view copy(char* to, std::string_view s) {
+            std::memcpy(to, s.data(), s.size());
+            return { to, s.size() };
+        }
+    };
+
+    /*
+     * macro body is compiled when defined into literal text, parameter slots
+     * and nested calls, so calling it is just writing out spans and looking
+     * up each parameter once. all strings are views into arena of the library.
+     */
+    struct Macro {
+        struct Segment {
+            enum Kind { LITERAL, PARAMETER, CALL, IF, ELSE, FOR, END } kind;
+
+            std::size_t offset, length;   // span of text, for LITERAL
+            std::size_t index;            // into parameters, calls or blocks otherwise
+        };
+
+        // #MCALL line in the body, its name and arguments may use parameters
+        struct Call {
+            std::vector<Segment> line = {};
+        };
+
+        /*
+         * #MIF or #MFOR up to its #MEND, its segments follow the one of
+         * the block. middle is the segment of #MELSE, or of #MEND if none.
+         */
+        struct Block {
+            std::vector<Segment> head = {};   // condition, or items of a loop
+            std::size_t parameter = 0;        // set to each item by #MFOR
+            std::size_t middle = 0, end = 0;
+        };
+
+        std::string_view name;
+        std::string_view text = {};
+        std::vector<std::string_view> parameters = {};
+        std::vector<Segment> segments = {};
+        std::vector<Call> calls = {};
+        std::vector<Block> blocks = {};
+        std::uint64_t hash = 0;   // of name and body as defined
+        bool counted = true;      // in stats, blocks in free text aren't
+
+        // none if its body was too large
+        static std::optional<Macro> read(Switch& sw) {
+            // stored only once all of the definition was read, reading a fed
+            // one can run out of input and start over any number of times
+            auto name = std::string(read_name(sw));
+            auto body = read_body(sw);
+            if (!body)
+                return std::nullopt;
+            auto& arena = sw.library.arena;
+            return compile(arena, arena.store(name), *body);
+        }
+
+        /*
+         * $ followed by anything up to whitespace is a parameter,
+         * except for $$ standing for $ and $__name for name of the macro.
+         * ## stands for #, and #MCALL makes the rest of its line a call.
+         *
+         * #MIF makes the rest of its line a condition, what follows up to
+         * #MELSE or #MEND is expanded if it holds, what follows #MELSE if
+         * it doesn't. #MFOR is followed by name of a parameter and items
+         * on its line, what follows up to #MEND is expanded for each item.
+         */
+        static Macro compile(Arena& arena, std::string_view name,
+                             std::string_view body) {
+            auto macro = Macro { name };
+            macro.hash = digest(body, digest(name));
+            auto text = std::string {};
+
+            auto literal = [&] (std::vector<Segment>& into, std::string_view s) {
+                if (s.empty())
+                    return;
+
+                // adjacent literals are merged into one span
+                if (!into.empty() && into.back().kind == Segment::LITERAL
+                        && into.back().offset + into.back().length == text.size())
+                    into.back().length += s.size();
+                else
+                    into.push_back({ Segment::LITERAL, text.size(), s.size(), 0 });
+                text.append(s);
+            };
+
+            auto index = [&] (std::string_view parameter) {
+                auto& parameters = macro.parameters;
+                auto it = std::find(parameters.begin(), parameters.end(), parameter);
+                auto index = static_cast<std::size_t>(it - parameters.begin());
+                if (it == parameters.end())
+                    parameters.push_back(arena.store(parameter));
+                return index;
+            };
+
+            auto slot = [&] (std::vector<Segment>& into, std::string_view parameter) {
+                into.push_back({ Segment::PARAMETER, 0, 0, index(parameter) });
+            };
+
+            // segments of blocks yet to be ended by #MEND, innermost last
+            auto open = std::vector<std::size_t> {};
+
+            auto begin_block = [&] (Segment::Kind kind) {
+                open.push_back(macro.segments.size());
+                macro.segments.push_back({ kind, 0, 0, macro.blocks.size() });
+                return &macro.blocks.emplace_back();
+            };
+
+            // #MELSE only once in #MIF
+            auto in_if = [&] {
+                if (open.empty())
+                    return false;
+                auto const& segment = macro.segments[open.back()];
+                return segment.kind == Segment::IF
+                    && macro.blocks[segment.index].middle == 0;
+            };
+
+            auto end_block = [&] {
+                auto index = macro.segments[open.back()].index;
+                auto& block = macro.blocks[index];
+                block.end = macro.segments.size();
+                if (block.middle == 0)
+                    block.middle = block.end;
+                macro.segments.push_back({ Segment::END, 0, 0, index });
+                open.pop_back();
+            };
+
+            // directives only as whole words, #MFORx is just text
+            auto directive = [&] (std::size_t i, std::string_view word) {
+                auto end = i + word.size();
+                return body.compare(i, word.size(), word) == 0
+                    && (end == body.size() || Scanner::SPACE.contains(body[end]));
+            };
+
+            // #MELSE and #MEND take their whole line
+            auto line_end = [&] (std::size_t i) {
+                auto end = body.find('\n', i);
+                return end == std::string_view::npos ? body.size() : end + 1;
+            };
+
+            // segments of the body, or of the line of a call or block being compiled
+            auto* into = &macro.segments;
+
+            static constexpr auto special      = Scanner::of("$#");
+            static constexpr auto special_call = Scanner::of("$#\n");
+            static constexpr auto blank        = Scanner::of("\n", Scanner::Set::NON_SPACE);
+            auto const* data = body.data();
+            auto const* last = data + body.size();
+
+            auto i = std::size_t { 0 };
+            while (i < body.size()) {
+                auto in_call = into != &macro.segments;
+                auto stop = static_cast<std::size_t>(
+                    Scanner::find(data + i, last, in_call ? special_call : special) - data);
+                literal(*into, body.substr(i, stop - i));
+                if (stop == body.size())
+                    break;
+
+                i = stop;
+                if (body[i] == '\n') {
+                    // newline ending a call is consumed with it
+                    into = &macro.segments;
+                    i += 1;
+                } else if (body.compare(i, 2, "##") == 0) {
+                    literal(*into, "#");
+                    i += 2;
+                } else if (!in_call && directive(i, "#MCALL")) {
+                    macro.segments.push_back({ Segment::CALL, 0, 0, macro.calls.size() });
+                    into = &macro.calls.emplace_back().line;
+                    i += 6;
+                } else if (!in_call && directive(i, "#MIF")) {
+                    into = &begin_block(Segment::IF)->head;
+                    i += 4;
+                } else if (!in_call && directive(i, "#MFOR")) {
+                    // parameter is on the line of #MFOR, or missing
+                    auto* block = begin_block(Segment::FOR);
+                    auto start = static_cast<std::size_t>(
+                        Scanner::find(data + i + 5, last, blank) - data);
+                    auto end = static_cast<std::size_t>(
+                        Scanner::find(data + start, last, Scanner::SPACE) - data);
+                    auto parameter = body.substr(start, end - start);
+                    if (!parameter.empty() && parameter[0] == '$')
+                        parameter.remove_prefix(1);
+                    block->parameter = index(unescape(parameter));
+                    into = &block->head;
+                    i = end;
+                } else if (!in_call && directive(i, "#MELSE") && in_if()) {
+                    auto index = macro.segments[open.back()].index;
+                    macro.blocks[index].middle = macro.segments.size();
+                    macro.segments.push_back({ Segment::ELSE, 0, 0, index });
+                    i = line_end(i);
+                } else if (!in_call && directive(i, "#MEND") && !open.empty()) {
+                    end_block();
+                    i = line_end(i);
+                } else if (body[i] == '#') {
+                    literal(*into, "#");
+                    i += 1;
+                } else {
+                    auto end = static_cast<std::size_t>(
+                        Scanner::find(data + i + 1, last, Scanner::SPACE) - data);
+
+                    auto parameter = unescape(body.substr(i + 1, end - i - 1));
+                    if (parameter == "$")
+                        literal(*into, "$");
+                    else if (parameter == "__name")
+                        literal(*into, name);
+                    else
+                        slot(*into, parameter);
+
+                    i = end;
+                }
+            }
+
+            // a block cut off by the end of input ends with it
+            while (!open.empty())
+                end_block();
+
+            macro.text = arena.store(text);
+            return macro;
+        }
+
+        void expand(Switch& sw, Arguments const& args) const {
+            // most macros are a run of literals and parameters
+            if (calls.empty() && blocks.empty() && !sw.stats) {
+                write(sw, segments, values(args), sw.os);
+                return;
+            }
+            if (calls.empty() && !sw.stats) {
+                write(sw, 0, segments.size(), values(args), sw.os, 0);
+                return;
+            }
+
+            auto out = std::string {};
+            expand(sw, args, out, 0);
+            sw.os.write(out.data(), out.size());
+        }
+
+        /*
+         * expansion of a macro with nested calls is appended to out and
+         * memoised by values of its parameters, unless it logged an error.
+         * a call repeating one which is still being expanded would never
+         * end, so it is reported instead, as is nesting beyond MAX_NESTING.
+         */
+        void expand(Switch& sw, Arguments const& args,
+                    std::string& out, std::size_t depth) const {
+            auto sample = Sample(sw, *this, out);
+            auto values = this->values(args);
+            if (calls.empty()) {
+                write(sw, 0, segments.size(), values, out, depth);
+                return;
+            }
+
+            // with stats every call is expanded, or those nested in a
+            // memoised one wouldn't be counted
+            auto key = this->key(values);
+            if (auto const* memoised = sw.stats ? nullptr : sw.memo.find(key)) {
+                out.append(*memoised);
+                return;
+            }
+
+            auto& active = sw.active;
+            if (std::find(active.begin(), active.end(), key) != active.end()) {
+                Error::log(sw, "recursive macro call: '", name, "'");
+                return;
+            }
+            if (depth == MAX_NESTING) {
+                Error::log(sw, "macro calls nested too deeply: '", name, "'");
+                return;
+            }
+
+            active.push_back(key);
+            auto errors = sw.errors;
+            auto begin = out.size();
+
+            write(sw, 0, segments.size(), values, out, depth);
+
+            active.pop_back();
+            if (sw.errors == errors && !sw.stats)
+                sw.memo.insert(std::move(key), out.substr(begin));
+        }
+
+        // view into the input, valid only until it's read further
+        static std::string_view read_name(Switch& sw) {
+            sw.ignore_whitespace();
+            auto word = sw.get_word();
+            if (word == "#MEND")
+                throw Exception { Error::MACRO_MISSING_NAME };
+            return word;
+        }
+
+        /*
+         * body can't grow past max_body of the switch. the error is logged
+         * as soon as it would, and the rest is skipped up to #MEND without
+         * keeping it, so #MDEF missing one can't take all input into memory.
+         */
+        static std::optional<std::string> read_body(Switch& sw, char block = 0) {
+            auto body = std::string {};
+            auto fits = true;
+            char c;
+
+            /*
+             * blocks open in the body, i for #MIF, e past its #MELSE, f for
+             * #MFOR. body of a block in free text starts in one already.
+             */
+            auto open = std::string(block ? 1 : 0, block);
+            auto outer = open.size();
+
+            // whitespace up to a newline
+            static constexpr auto blank = Scanner::of("\n", Scanner::Set::NON_SPACE);
+
+            auto append = [&] (std::string_view text) {
+                if (!fits)
+                    return;
+                if (text.size() > sw.max_body - body.size()) {
+                    Error::log(sw, Error::MACRO_BODY_SIZE);
+                    std::string().swap(body);
+                    fits = false;
+                    return;
+                }
+                /*
+                 * doubles until it's more than half of max_body, then takes
+                 * all of it at once. reserve may round up to twice the
+                 * capacity it already has, so it's made on an empty string.
+                 */
+                if (text.size() > body.capacity() - body.size()) {
+                    auto capacity = std::max(2 * body.capacity(),
+                                             body.size() + text.size());
+                    auto grown = std::string {};
+                    grown.reserve(capacity > sw.max_body / 2 ? sw.max_body : capacity);
+                    grown.append(body);
+                    body.swap(grown);
+                }
+                body.append(text);
+            };
+
+            // ignore any leading whitespace, newline begins macro body
+            while (std::isspace(sw.peek()) && sw.get(c))
+                if (c == '\n')
+                    break;
+
+            // body cut off by the end of fed input can't end before its #MEND
+            sw.reader.await("#MEND");
+            while (true) {
+                // text up to the next # is taken as it is
+                auto text = sw.reader.until('#');
+                if (!text.empty()) {
+                    append(text);
+                    sw.position.advance(text);
+                    continue;
+                }
+
+                if (!sw.get(c))
+                    break;
+
+                auto command = sw.get_word();
+
+                // kept as they are, for compile to tell apart
+                if (command == "#") {
+                    append("##");
+                } else if (command == "MCALL") {
+                    append("#MCALL");
+                } else if (command == "MIF") {
+                    open.push_back('i');
+                    append("#MIF");
+                } else if (command == "MFOR") {
+                    open.push_back('f');
+                    append("#MFOR");
+
+                    // whitespace is kept, so that the parameter stays apart
+                    for (auto span = sw.reader.until(blank); !span.empty();
+                            span = sw.reader.until(blank)) {
+                        append(span);
+                        sw.position.advance(span);
+                    }
+                    if (sw.peek() == '\n' || sw.peek() == EOF)
+                        Error::log(sw, Error::MFOR_MISSING_PARAMETER);
+                } else if (command == "MELSE" && !open.empty() && open.back() == 'i') {
+                    open.back() = 'e';
+                    append("#MELSE");
+                } else if (command == "MEND" && open.size() > outer) {
+                    open.pop_back();
+                    append("#MEND");
+                } else if (command == "MEND") {
+                    break;
+                } else {
+                    Error::log(sw, Error::POUND_MACRO_BODY);
+                }
+            }
+
+            sw.reader.await({});
+
+            // ignore trainling newline (?)
+            sw.get(c);
+
+            if (!fits)
+                return std::nullopt;
+            return body;
+        }
+
+    private:
+        static constexpr std::size_t MAX_NESTING = 64;
+
+        // a call recorded into stats, from construction to destruction
+        class Sample {
+            Stats::Usage* usage = nullptr;
+            std::string const& out;
+            std::size_t begin = out.size();
+            std::chrono::steady_clock::time_point start = {};
+
+        public:
+            Sample(Switch& sw, Macro const& macro, std::string const& out)
+                : out(out) {
+                if (!sw.stats || !macro.counted)
+                    return;
+                usage = &(*sw.stats)[macro.name];
+                usage->calls += 1;
+                usage->lookups += macro.parameters.size();
+                start = std::chrono::steady_clock::now();
+            }
+
+            ~Sample() {
+                if (!usage)
+                    return;
+                usage->bytes += out.size() - begin;
+                usage->time += std::chrono::steady_clock::now() - start;
+            }
+        };
+
+        // values of parameters in their order, null if missing from a call
+        using Values = SmallVector<std::string_view const*, 8>;
+
+        Values values(Arguments const& args) const {
+            auto values = Values(parameters.size());
+            for (auto i = std::size_t { 0 }; i < parameters.size(); ++i)
+                values[i] = args.find(parameters[i]);
+            return values;
+        }
+
+        // identifies the macro and values of its parameters, missing or not
+        std::string key(Values const& values) const {
+            auto const* self = this;
+            auto key = std::string(reinterpret_cast<char const*>(&self), sizeof(self));
+            for (auto const* value : values) {
+                auto size = value ? value->size() : static_cast<std::size_t>(-1);
+                key.append(reinterpret_cast<char const*>(&size), sizeof(size));
+                if (value)
+                    key.append(*value);
+            }
+            return key;
+        }
+
+        /*
+         * segments from first up to last, blocks are walked in place, so
+         * a loop only writes what the body was compiled into once more
+         */
+        template<class Out>
+        void write(Switch& sw, std::size_t first, std::size_t last,
+                   Values const& values, Out& out, std::size_t depth) const {
+            for (auto i = first; i < last; ++i) {
+                if constexpr (std::is_base_of_v<std::ostream, Out>)
+                    if (!out)
+                        break;
+
+                auto const& segment = segments[i];
+                switch (segment.kind) {
+                case Segment::LITERAL:
+                case Segment::PARAMETER:
+                    write(sw, segment, values, out);
+                    break;
+                case Segment::CALL:
+                    // only macros with calls are expanded into a string
+                    if constexpr (std::is_same_v<Out, std::string>)
+                        call(sw, calls[segment.index], values, out, depth);
+                    break;
+                case Segment::IF: {
+                    auto const& block = blocks[segment.index];
+                    if (holds(head(block, values)))
+                        write(sw, i + 1, block.middle, values, out, depth);
+                    else if (block.middle != block.end)
+                        write(sw, block.middle + 1, block.end, values, out, depth);
+                    i = block.end;
+                    break;
+                }
+                case Segment::FOR: {
+                    auto const& block = blocks[segment.index];
+                    auto bound = values;
+                    each(head(block, values), [&] (std::string_view item) {
+                        bound[block.parameter] = &item;
+                        write(sw, i + 1, block.end, bound, out, depth);
+                    });
+                    i = block.end;
+                    break;
+                }
+                case Segment::ELSE:
+                case Segment::END:
+                    break;
+                }
+            }
+        }
+
+        void call(Switch& sw, Call const& call, Values const& values,
+                  std::string& out, std::size_t depth) const {
+            auto line = std::string {};
+            write(sw, call.line, values, line);
+
+            auto const* first = line.data();
+            auto const* last  = first + line.size();
+            auto const* start = Scanner::find(first, last, Scanner::NON_SPACE);
+            auto const* end   = Scanner::find(start, last, Scanner::SPACE);
+            auto callee = std::string_view(start, end - start);
+
+            if (auto const* macro = sw.library.get(sw, callee))
+                macro->expand(sw, Arguments::parse({ end, static_cast<std::size_t>(last - end) }),
+                              out, depth + 1);
+        }
+
+        // parameters missing from the call are empty, so #MIF $p tells if p was given
+        std::string head(Block const& block, Values const& values) const {
+            auto head = std::string {};
+            for (auto const& segment : block.head)
+                if (segment.kind == Segment::LITERAL)
+                    head.append(text.substr(segment.offset, segment.length));
+                else if (auto const* value = values[segment.index])
+                    head.append(*value);
+            return head;
+        }
+
+        static std::string_view trim(std::string_view s) {
+            auto first = s.find_first_not_of(" \t\r\n");
+            if (first == std::string_view::npos)
+                return {};
+            return s.substr(first, s.find_last_not_of(" \t\r\n") - first + 1);
+        }
+
+        /*
+         * a = b and a != b compare both sides, anything else holds unless
+         * empty. parameters end at whitespace, so it has to follow them.
+         */
+        static bool holds(std::string_view condition) {
+            auto i = condition.find('=');
+            if (i == std::string_view::npos)
+                return !trim(condition).empty();
+
+            auto negated = i > 0 && condition[i - 1] == '!';
+            auto lhs = trim(condition.substr(0, negated ? i - 1 : i));
+            auto rhs = trim(condition.substr(i + 1));
+            return (lhs == rhs) != negated;
+        }
+
+        // a..b counts from a to b, other items are separated by whitespace or commas
+        template<class F>
+        static void each(std::string_view items, F const& f) {
+            auto number = [] (std::string_view s, long long& n) {
+                auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), n);
+                return !s.empty() && ec == std::errc {} && end == s.data() + s.size();
+            };
+
+            items = trim(items);
+            auto dots = items.find("..");
+            auto from = 0LL, to = 0LL;
+            if (dots != std::string_view::npos && number(items.substr(0, dots), from)
+                    && number(items.substr(dots + 2), to)) {
+                char buffer[24];
+                for (auto n = from; ; n += from < to ? 1 : -1) {
+                    auto end = std::to_chars(buffer, buffer + sizeof(buffer), n).ptr;
+                    f(std::string_view(buffer, end - buffer));
+                    if (n == to)
+                        break;
+                }
+                return;
+            }
+
+            auto separator = [] (char c) {
+                return c == ',' || std::isspace(static_cast<unsigned char>(c));
+            };
+            for (auto i = std::size_t { 0 }; i < items.size(); ) {
+                auto end = i;
+                while (end < items.size() && !separator(items[end]))
+                    ++end;
+                if (end > i)
+                    f(items.substr(i, end - i));
+                i = end + 1;
+            }
+        }
+
+        static void put(std::ostream& os, std::string_view s) {
+            os.write(s.data(), s.size());
+        }
+
+        static void put(std::string& out, std::string_view s) {
+            out.append(s);
+        }
+
+        // literals and parameters, calls are expanded by expand
+        template<class Out>
+        void write(Switch& sw, std::vector<Segment> const& segments,
+                   Values const& values, Out& out) const {
+            for (auto const& segment : segments) {
+                if constexpr (std::is_base_of_v<std::ostream, Out>)
+                    if (!out)
+                        break;
+                write(sw, segment, values, out);
+            }
+        }
+
+        template<class Out>
+        void write(Switch& sw, Segment const& segment,
+                   Values const& values, Out& out) const {
+            if (segment.kind == Segment::LITERAL) {
+                put(out, text.substr(segment.offset, segment.length));
+            } else if (auto const* value = values[segment.index]) {
+                put(out, *value);
+            } else {
+                Error::log(sw, "missing parameter '",
+                           parameters[segment.index], "'");
+                if (sw.stats && counted)
+                    (*sw.stats)[name].missing += 1;
+            }
+        }
+
+        // ## in a parameter name stands for #, as anywhere else in the body
+        static std::string unescape(std::string_view s) {
+            auto unescaped = std::string(s);
+            for (auto i = unescaped.find("##"); i != std::string::npos;
+                    i = unescaped.find("##", i + 1))
+                unescaped.erase(i, 1);
+            return unescaped;
+        }
+    };
+
+
+    Reader reader;
+    std::ostream& os;
+
+    /*
+     * macros keyed by views of their names in the arena, so a name read
+     * off the input can be looked up without making a string of it
+     */
+    class Library {
+        std::unordered_map<std::string_view, Macro> _;
+        Library const* base = nullptr;
+
+    public:
+        Arena arena;
+
+        Library() = default;
+
+        // macros missing from this library are looked up in base
+        explicit Library(Library const* base) : base(base) {}
+
+        // nothing defined in this library itself
+        bool empty() const {
+            return _.empty();
+        }
+
+        Library const* fallback() const {
+            return base;
+        }
+
+        std::size_t depth() const {
+            return base ? base->depth() + 1 : 1;
+        }
+
+        /*
+         * one library with every macro visible from this one, it refers
+         * to arenas of the libraries it was made from
+         */
+        Library flattened() const {
+            auto flat = Library {};
+            collect(flat._);
+            return flat;
+        }
+
+        bool contains(std::string_view name) const {
+            return find(name) != nullptr;
+        }
+
+        Macro const* find(std::string_view name) const {
+            if (auto it = _.find(name); it != _.end())
+                return &it->second;
+            return base ? base->find(name) : nullptr;
+        }
+
+        void add(Switch& sw, Macro macro) {
+            if (contains(macro.name))
+                Error::log(sw, "overwriting macro '", macro.name, "'");
+            // body of overwritten macro stays in the arena
+            _.insert_or_assign(macro.name, std::move(macro));
+        }
+
+        Macro const* get(Switch& sw, std::string_view name) const {
+            auto const* macro = find(name);
+
+            // a macro this library doesn't define itself comes from elsewhere
+            if (sw.dependencies && _.find(name) == _.end())
+                sw.dependencies->called.emplace(name, macro ? macro->hash : 0);
+
+            if (macro) {
+                return macro;
+            } else {
+                Error::log(sw, "missing macro definition: '", name, "'");
+                return nullptr;
+            }
+        }
+
+        /*
+         * macros visible from this library sorted by name, as native
+         * 64 bit numbers and strings each preceded by its size
+         */
+        void dump(std::ostream& os) const {
+            auto macros = std::map<std::string_view, Macro const*> {};
+            collect(macros);
+
+            auto put = [&] (std::uint64_t n) {
+                os.write(reinterpret_cast<char const*>(&n), sizeof(n));
+            };
+            auto put_text = [&] (std::string_view s) {
+                put(s.size());
+                os.write(s.data(), s.size());
+            };
+            auto put_segments = [&] (std::vector<Macro::Segment> const& segments) {
+                put(segments.size());
+                for (auto const& segment : segments) {
+                    put(segment.kind);
+                    put(segment.offset);
+                    put(segment.length);
+                    put(segment.index);
+                }
+            };
+
+            os.write(MAGIC.data(), MAGIC.size());
+            put(macros.size());
+            for (auto const& [name, macro] : macros) {
+                put_text(name);
+                put_text(macro->text);
+                put(macro->hash);
+                put(macro->parameters.size());
+                for (auto const& parameter : macro->parameters)
+                    put_text(parameter);
+                put_segments(macro->segments);
+                put(macro->calls.size());
+                for (auto const& call : macro->calls)
+                    put_segments(call.line);
+                put(macro->blocks.size());
+                for (auto const& block : macro->blocks) {
+                    put_segments(block.head);
+                    put(block.parameter);
+                    put(block.middle);
+                    put(block.end);
+                }
+            }
+        }
+
+        // macros written by dump, strings are views into image
+        void load(std::string_view image) {
+            auto invalid = [] {
+                return Exception { Error::LIBRARY_FILE };
+            };
+
+            if (image.substr(0, MAGIC.size()) != MAGIC)
+                throw invalid();
+            image.remove_prefix(MAGIC.size());
+
+            auto get = [&] {
+                auto n = std::uint64_t { 0 };
+                if (image.size() < sizeof(n))
+                    throw invalid();
+                std::memcpy(&n, image.data(), sizeof(n));
+                image.remove_prefix(sizeof(n));
+                return n;
+            };
+            auto get_text = [&] {
+                auto size = get();
+                if (size > image.size())
+                    throw invalid();
+                auto text = image.substr(0, size);
+                image.remove_prefix(size);
+                return text;
+            };
+            for (auto count = get(); count > 0; --count) {
+                auto macro = Macro { get_text() };
+                macro.text = get_text();
+                macro.hash = get();
+                for (auto n = get(); n > 0; --n)
+                    macro.parameters.push_back(get_text());
+
+                // segments have to stay within what the macro has
+                auto get_segments = [&] (bool calls) {
+                    auto segments = std::vector<Macro::Segment> {};
+                    auto n = get();
+                    if (n > image.size() / (4 * sizeof(std::uint64_t)))
+                        throw invalid();
+                    segments.reserve(n);
+                    for (; n > 0; --n) {
+                        auto kind   = get();
+                        auto offset = get();
+                        auto length = get();
+                        auto index  = get();
+                        auto valid = false;
+                        switch (kind) {
+                        case Macro::Segment::LITERAL:
+                            valid = offset <= macro.text.size()
+                                && length <= macro.text.size() - offset;
+                            break;
+                        case Macro::Segment::PARAMETER:
+                            valid = index < macro.parameters.size();
+                            break;
+                        case Macro::Segment::CALL:
+                        case Macro::Segment::IF:
+                        case Macro::Segment::ELSE:
+                        case Macro::Segment::FOR:
+                        case Macro::Segment::END:
+                            valid = calls;
+                        }
+                        if (!valid)
+                            throw invalid();
+                        segments.push_back({
+                            static_cast<Macro::Segment::Kind>(kind),
+                            offset, length, index
+                        });
+                    }
+                    return segments;
+                };
+
+                macro.segments = get_segments(true);
+                for (auto n = get(); n > 0; --n)
+                    macro.calls.push_back({ get_segments(false) });
+                for (auto n = get(); n > 0; --n) {
+                    auto& block = macro.blocks.emplace_back();
+                    block.head = get_segments(false);
+                    block.parameter = get();
+                    block.middle = get();
+                    block.end = get();
+                }
+
+                // blocks have to end after they begin, so walking them ends
+                auto const& segments = macro.segments;
+                for (auto i = std::size_t { 0 }; i < segments.size(); ++i) {
+                    auto const& segment = segments[i];
+                    auto valid = true;
+                    switch (segment.kind) {
+                    case Macro::Segment::CALL:
+                        valid = segment.index < macro.calls.size();
+                        break;
+                    case Macro::Segment::IF:
+                    case Macro::Segment::FOR: {
+                        if (segment.index >= macro.blocks.size())
+                            throw invalid();
+                        auto const& block = macro.blocks[segment.index];
+                        valid = i < block.middle && block.middle <= block.end
+                            && block.end < segments.size()
+                            && (segment.kind == Macro::Segment::IF
+                                || block.parameter < macro.parameters.size());
+                        break;
+                    }
+                    default:
+                        break;
+                    }
+                    if (!valid)
+                        throw invalid();
+                }
+
+                auto name = macro.name;
+                _.insert_or_assign(name, std::move(macro));
+            }
+
+            if (!image.empty())
+                throw invalid();
+        }
+
+    private:
+        static constexpr auto MAGIC = std::string_view("ecotelib2\n");
+
+        void collect(std::unordered_map<std::string_view, Macro>& into) const {
+            if (base)
+                base->collect(into);
+            for (auto const& [name, macro] : _)
+                into.insert_or_assign(name, macro);
+        }
+
+        void collect(std::map<std::string_view, Macro const*>& into) const {
+            if (base)
+                base->collect(into);
+            for (auto const& [name, macro] : _)
+                into.insert_or_assign(name, &macro);
+        }
+
+    } library = {};
+
+    Position position;
+
+    std::ostream* diagnostics = &std::cerr;
+    bool expanding = true;
+
+    // errors logged so far, expansions which logged some aren't memoised
+    std::size_t errors = 0;
+
+    /*
+     * expansions of macros with nested calls keyed by Macro::key, dropped
+     * whenever a macro is defined, as it may change what they expand to
+     */
+    class Memo {
+        static constexpr std::size_t MAX_SIZE = 1 << 24;
+
+        std::unordered_map<std::string, std::string> _;
+        std::size_t size = 0;
+
+    public:
+        std::string const* find(std::string const& key) const {
+            auto it = _.find(key);
+            return it != _.end() ? &it->second : nullptr;
+        }
+
+        void insert(std::string key, std::string expansion) {
+            size += key.size() + expansion.size();
+            if (size > MAX_SIZE) {
+                clear();
+                size = key.size() + expansion.size();
+            }
+            _.insert_or_assign(std::move(key), std::move(expansion));
+        }
+
+        void clear() {
+            _.clear();
+            size = 0;
+        }
+    } memo;
+
+    // keys of expansions in progress, to catch calls which would never end
+    std::vector<std::string> active;
+
+    // chunks the input is split into, and how many layers deep library can get
+    static constexpr std::size_t CHUNK_SIZE = 1 << 20;
+    static constexpr std::size_t MAX_DEPTH  = 8;
+
+    /*
+     * output and errors of a chunk, cuts are sizes of both taken whenever
+     * output was flushed. errors are logged right after such flush, so in
+     * between two cuts errors came first and output after them.
+     */
+    struct Result {
+        std::string output, diagnostics;
+        std::vector<std::pair<std::size_t, std::size_t>> cuts;
+        int code = 0;
+    };
+
+    // output of a chunk, cut at each flush
+    struct ChunkBuffer : StringBuffer {
+        StringBuffer const& diagnostics;
+        std::vector<std::pair<std::size_t, std::size_t>> cuts = {};
+
+        ChunkBuffer(StringBuffer const& diagnostics) : diagnostics(diagnostics) {}
+
+        int sync() override {
+            cuts.push_back({ text.size(), diagnostics.text.size() });
+            return 0;
+        }
+    };
+
+    /*
+     * part of input which can be expanded on its own, given macros visible
+     * at its beginning and position of the beginning for errors
+     */
+    struct Chunk {
+        std::size_t begin, end;
+        Position position;
+        Library const* library;
+
+        Result expand(std::string_view input, std::size_t max_body) const {
+            auto diagnostics_buffer = StringBuffer {};
+            auto output_buffer      = ChunkBuffer(diagnostics_buffer);
+            auto output      = std::ostream(&output_buffer);
+            auto diagnostics = std::ostream(&diagnostics_buffer);
+
+            auto sw = Switch(input.substr(begin, end - begin), output,
+                             library, position);
+            sw.diagnostics = &diagnostics;
+            sw.max_body    = max_body;
+
+            auto code = 0;
+            try {
+                sw.process();
+            } catch (Exception const& ex) {
+                Error::log(sw, ex.what());
+                code = ex.error.code;
+            }
+
+            return {
+                std::move(output_buffer.text),
+                std::move(diagnostics_buffer.text),
+                std::move(output_buffer.cuts),
+                code
+            };
+        }
+    };
+
+    // output and errors of a chunk in the order they were written
+    void write(Result const& result) {
+        auto output      = std::string_view(result.output);
+        auto diagnostics = std::string_view(result.diagnostics);
+        auto from = std::pair<std::size_t, std::size_t> { 0, 0 };
+
+        // whatever follows the last cut comes after it, as between any two
+        for (auto i = std::size_t { 0 }; i <= result.cuts.size(); ++i) {
+            auto cut = i < result.cuts.size()
+                ? result.cuts[i]
+                : std::pair { output.size(), diagnostics.size() };
+            if (cut.second > from.second) {
+                os.flush();
+                std::cerr << diagnostics.substr(from.second, cut.second - from.second);
+            }
+            os.write(output.data() + from.first, cut.first - from.first);
+            from = cut;
+        }
+    }
+
+    friend class Engine;
+
+    // input is handed over by feed of reader
+    Switch(std::string filename, std::ostream& os, Switch const* prelude,
+           std::ostream& diagnostics)
+        : os(os)
+        , library(prelude ? &prelude->library : nullptr)
+        , position(std::move(filename))
+        , diagnostics(&diagnostics)
+    {
+        reader.track(position);
+    }
+
+    Switch(std::string_view input, std::ostream& os,
+           Library const* base, Position position)
+        : reader(input)
+        , os(os)
+        , library(base)
+        , position(std::move(position))
+    {
+        reader.track(this->position);
+    }
+
+    /*
+     * first phase of run_parallel, goes through input only defining macros.
+     * libraries of macros visible at the start of chunks are kept in layers.
+     */
+    std::vector<Chunk> split(std::string_view input, std::deque<Library>& layers) {
+        auto null    = NullBuffer {};
+        auto discard = std::ostream(&null);
+
+        auto scanner = Switch(input, discard, &library, position);
+        scanner.diagnostics = &discard;
+        scanner.expanding   = false;
+        scanner.max_body    = max_body;
+
+        auto chunks = std::vector<Chunk> {
+            Chunk { 0, 0, position, &library }
+        };
+
+        /*
+         * on a fatal error the last chunk runs to the end of input,
+         * so it is reported by the second phase, with its output
+         */
+        try {
+            while (scanner.step()) {
+                if (scanner.reader.offset() - chunks.back().begin < CHUNK_SIZE)
+                    continue;
+
+                auto offset = scanner.reader.offset();
+                chunks.back().end = offset;
+                // chunk can't count lines in input before it
+                scanner.reader.count(scanner.position.offset);
+                chunks.push_back({
+                    offset, 0, scanner.position, scanner.freeze(layers)
+                });
+            }
+        } catch (Exception const&) {}
+
+        chunks.back().end = input.size();
+        return chunks;
+    }
+
+    // library as it is now, moved into layers if it defined anything
+    Library const* freeze(std::deque<Library>& layers) {
+        if (library.empty())
+            return library.fallback();
+
+        layers.push_back(std::move(library));
+        if (layers.back().depth() > MAX_DEPTH)
+            layers.push_back(layers.back().flattened());
+
+        library = Library(&layers.back());
+        return &layers.back();
+    }
+
+    // handles next span of free text or directive, false at the end of input
+    bool step() {
+        // free text is copied in spans up to the next #
+        auto text = reader.until('#');
+        if (!text.empty()) {
+            position.advance(text);
+            os.write(text.data(), text.size());
+            return true;
+        }
+
+        char c;
+        if (!get(c))
+            return false;
+        pound();
+        return true;
+    }
+
+    void pound() {
+        auto command = get_word();
+
+        if (command == "#")
+            os << '#';
+        else if (command == "MDEF")
+            macro_def();
+        else if (command == "MCALL")
+            macro_call();
+        else if (command == "MIF" || command == "MFOR")
+            block(command == "MIF" ? "#MIF" : "#MFOR");
+        else if (command == "MEND")
+            Error::log(*this, Error::CORRESPONDING_MDEF);
+        else
+            Error::log(*this, Error::POUND_FREE_TEXT);
+    }
+
+    void macro_def() try {
+        auto macro = Macro::read(*this);
+        if (!macro)
+            return;
+        if (dependencies)
+            dependencies->defined.insert_or_assign(std::string(macro->name), macro->hash);
+        library.add(*this, std::move(*macro));
+        memo.clear();
+    } catch (Exception const& ex) {
+        Error::log(*this, ex.what());
+    }
+
+    /*
+     * #MIF or #MFOR in free text is read up to its #MEND like a macro body,
+     * and expanded right away as a macro without parameters
+     */
+    void block(std::string_view directive) try {
+        auto body = std::string(directive);
+        for (auto line = reader.until('\n'); !line.empty(); line = reader.until('\n')) {
+            position.advance(line);
+            body.append(line);
+        }
+        auto const* head = body.data() + directive.size();
+        auto const* end  = body.data() + body.size();
+        if (directive == "#MFOR" && Scanner::find(head, end, Scanner::NON_SPACE) == end)
+            Error::log(*this, Error::MFOR_MISSING_PARAMETER);
+        body.push_back('\n');
+
+        auto rest = Macro::read_body(*this, directive == "#MIF" ? 'i' : 'f');
+        if (!rest || !expanding)
+            return;
+        body.append(*rest).append("#MEND");
+
+        auto arena = Arena {};
+        auto macro = Macro::compile(arena, directive, body);
+        macro.counted = false;
+        macro.expand(*this, Arguments {});
+
+        // memo is keyed by address of the macro, which is about to go away
+        if (!macro.calls.empty())
+            memo.clear();
+    } catch (Exception const& ex) {
+        Error::log(*this, ex.what());
+    }
+
+    void macro_call() {
+        auto const* macro = library.get(*this, Macro::read_name(*this));
+        auto arguments = Arguments::read(*this);
+        if (macro && expanding)
+            macro->expand(*this, arguments);
+
+        // ignore following newline, only after expanding so errors point
+        // at the line of the call
+        char c;
+        get(c);
+    }
+
+    bool get(char& c) {
+        if (!reader.get(c))
+            return false;
+        position.advance(c);
+        return true;
+    }
+
+    int peek() {
+        return reader.peek();
+    }
+
+    void ignore_whitespace() {
+        skip(Scanner::NON_SPACE);
+    }
+
+    // consume input up to a byte of set
+    void skip(Scanner::Set const& set) {
+        for (auto span = reader.until(set); !span.empty(); span = reader.until(set))
+            position.advance(span);
+    }
+
+    // view into the input, valid only until it's read further
+    std::string_view get_word() {
+        auto word = reader.until_space();
+        position.advance(word);
         return word;
     }
 };
 
 
+/*
+ * macroprocessor for embedding, input is pushed in pieces of any size by
+ * feed and ended by finish. what can be processed is written to the sink
+ * right away, a directive cut off by the end of what was fed so far is
+ * retried once a feed brings what it waits for, like its #MEND. fatal
+ * errors are returned instead of exiting, after one the engine does
+ * nothing until reset. reset starts a new input keeping macros defined
+ * by the previous ones.
+ *
+ * to embed it, define MACROPROCESSOR_NO_MAIN and include this file, it
+ * then has no main of its own, as in bench/bench.cpp.
+ */
+class Engine {
+public:
+    struct Sink {
+        std::function<void(std::string_view)> output;
+        // every diagnostic as a line run would log, without the newline
+        std::function<void(std::string_view)> diagnostic;
+    };
+
+    using Status = std::optional<Switch::Error>;
+
+    Engine(std::string name, Sink sink, Switch const* prelude = nullptr)
+        : sink(std::move(sink))
+        , sw(std::move(name), output, prelude, diagnostics)
+    {}
+
+    Engine(Engine const&) = delete;
+    Engine& operator =(Engine const&) = delete;
+
+    Status feed(std::string_view input) {
+        if (failed)
+            return failed;
+        if (!sw.reader.feed(input))
+            return {};
+        return pump();
+    }
+
+    Status finish() {
+        if (failed)
+            return failed;
+        sw.reader.finish();
+        return pump();
+    }
+
+    void reset(std::string name) {
+        sw.position = Switch::Position(std::move(name));
+        sw.reader.reset();
+        sw.errors = 0;
+        sw.memo.clear();
+        sw.active.clear();
+        output_buffer.text.clear();
+        diagnostics_buffer.text.clear();
+        output.clear();
+        failed.reset();
+    }
+
+private:
+    Sink sink;
+
+    StringBuffer output_buffer;
+    StringBuffer diagnostics_buffer;
+    std::ostream output { &output_buffer };
+    std::ostream diagnostics { &diagnostics_buffer };
+
+    Switch sw;
+    Status failed;
+
+    Status pump() try {
+        while (true) {
+            // all of position but its filename, which can't change
+            auto const* mark = sw.reader.mark();
+            auto offset  = sw.position.offset;
+            auto counted = sw.position.counted;
+            auto line    = sw.position.line;
+            auto column  = sw.position.column;
+            auto errors  = sw.errors;
+            sw.reader.await({});
+
+            try {
+                if (!sw.step())
+                    break;
+            } catch (Switch::Reader::Incomplete const&) {
+                // nothing of a directive is kept until all of it was read
+                sw.reader.rewind(mark);
+                sw.position.offset  = offset;
+                sw.position.counted = counted;
+                sw.position.line    = line;
+                sw.position.column  = column;
+                sw.errors = errors;
+                output_buffer.text.clear();
+                diagnostics_buffer.text.clear();
+                break;
+            }
+
+            flush();
+            if (!sw.os)
+                throw Switch::Exception { Switch::Error::OS_FAIL };
+        }
+        return {};
+    } catch (Switch::Exception const& ex) {
+        Switch::Error::log(sw, ex.what());
+        flush();
+        failed = ex.error;
+        return failed;
+    }
+
+    void flush() {
+        if (!output_buffer.text.empty() && sink.output)
+            sink.output(output_buffer.text);
+        output_buffer.text.clear();
+
+        auto text = std::string_view(diagnostics_buffer.text);
+        for (auto nl = text.find('\n'); nl != text.npos; nl = text.find('\n')) {
+            if (sink.diagnostic)
+                sink.diagnostic(text.substr(0, nl));
+            text.remove_prefix(nl + 1);
+        }
+        diagnostics_buffer.text.clear();
+    }
+};
+
+
+struct Options {
+    unsigned jobs = std::max(1U, std::thread::hardware_concurrency());
+    bool jobs_given = false;
+    bool parallel = false;
+    bool incremental = false;
+    char const* prelude = nullptr;
+    char const* library = nullptr;
+    char const* dump = nullptr;
+    char const* stats = nullptr;
+    std::size_t max_body = Switch::MAX_BODY;
+    std::vector<char const*> files = {};
+
+    static Options parse(int argc, char* argv[]) {
+        auto options = Options {};
+
+        for (auto i = 1; i < argc; ++i) {
+            auto arg = std::string_view(argv[i]);
+            auto value = [&] {
+                if (++i == argc)
+                    throw Switch::Exception { Switch::Error::USAGE };
+                return argv[i];
+            };
+
+            if (arg == "-j" || arg == "--jobs") {
+                auto jobs = std::atoi(value());
+                if (jobs < 1)
+                    throw Switch::Exception { Switch::Error::USAGE };
+                options.jobs = jobs;
+                options.jobs_given = true;
+            } else if (arg == "--parallel") {
+                options.parallel = true;
+            } else if (arg == "--incremental") {
+                options.incremental = true;
+            } else if (arg == "--prelude") {
+                options.prelude = value();
+            } else if (arg == "--library") {
+                options.library = value();
+            } else if (arg == "--dump-library") {
+                options.dump = value();
+            } else if (arg == "--max-body") {
+                options.max_body = size(value());
+            } else if (arg == "--stats") {
+                options.stats = value();
+                if (options.stats != std::string_view("text")
+                        && options.stats != std::string_view("json"))
+                    throw Switch::Exception { Switch::Error::USAGE };
+            } else if (arg.size() > 1 && arg[0] == '-') {
+                throw Switch::Exception { Switch::Error::USAGE };
+            } else {
+                options.files.push_back(argv[i]);
+            }
+        }
+
+        // there's nothing to dump without a library
+        if (options.dump && !options.prelude && !options.library)
+            throw Switch::Exception { Switch::Error::USAGE };
+
+        // stats are collected only by a single switch running on its own
+        if (options.stats && (options.parallel || options.files.size() > 1))
+            throw Switch::Exception { Switch::Error::USAGE };
+
+        // files written to targets are each processed by one thread
+        if (options.parallel && options.files.size() > 1)
+            throw Switch::Exception { Switch::Error::USAGE };
+
+        return options;
+    }
+
+    // of options which change output, cached along with dependencies
+    std::uint64_t digest() const {
+        auto path = [] (char const* p) {
+            if (!p)
+                return std::string {};
+            return std::filesystem::absolute(p).lexically_normal().string();
+        };
+
+        auto text = std::to_string(max_body);
+        text.append(1, '\0').append(path(library));
+        text.append(1, '\0').append(path(prelude));
+        return Switch::digest(text);
+    }
+
+    // sizes like 512K, 16M or 1G
+    static std::size_t size(char const* s) {
+        char* end;
+        errno = 0;
+        auto n = std::strtoull(s, &end, 10);
+        auto shift = 0;
+        switch (*end) {
+        case 'K': shift = 10; ++end; break;
+        case 'M': shift = 20; ++end; break;
+        case 'G': shift = 30; ++end; break;
+        }
+        if (end == s || *end || errno || n == 0 || n > (~0ULL >> shift))
+            throw Switch::Exception { Switch::Error::USAGE };
+        return n << shift;
+    }
+};
+
+struct Job {
+    std::filesystem::path source, target;
+};
+
+/*
+ * pairs of source and target files, a source directory is processed
+ * file by file into the same tree under its target directory
+ */
+std::vector<Job> jobs(std::vector<char const*> const& files) {
+    namespace fs = std::filesystem;
+
+    if (files.size() % 2 != 0)
+        throw Switch::Exception { Switch::Error::BATCH_ARGUMENTS };
+
+    auto jobs = std::vector<Job> {};
+    for (auto i = std::size_t { 0 }; i < files.size(); i += 2) {
+        auto source = fs::path(files[i]);
+        auto target = fs::path(files[i + 1]);
+
+        if (!fs::is_directory(source)) {
+            jobs.push_back({ source, target });
+            continue;
+        }
+
+        for (auto const& entry : fs::recursive_directory_iterator(source))
+            if (entry.is_regular_file())
+                jobs.push_back({
+                    entry.path(),
+                    target / fs::relative(entry.path(), source)
+                });
+    }
+    return jobs;
+}
+
+std::uint64_t digest(std::filesystem::path const& path) {
+    auto is = std::ifstream(path, std::ios::binary);
+    auto block = std::vector<char>(1 << 16);
+    auto hash = Switch::digest({});
+
+    while (is.read(block.data(), block.size()) || is.gcount())
+        hash = Switch::digest({ block.data(), static_cast<std::size_t>(is.gcount()) }, hash);
+    if (is.bad())
+        throw Switch::Exception { Switch::Error::IS_FAIL };
+
+    return hash;
+}
+
+/*
+ * library is written next to path first and renamed over it only once
+ * all of it was written, so a failed dump leaves what was there before.
+ * input given by mistake isn't overwritten. anything but a regular file,
+ * like /dev/stdout, is written to directly.
+ */
+void dump(Switch const& library, Options const& options) {
+    namespace fs = std::filesystem;
+
+    auto path = fs::path(options.dump);
+    auto inputs = options.files;
+    inputs.push_back(options.prelude);
+    inputs.push_back(options.library);
+    for (auto const* input : inputs) {
+        auto error = std::error_code {};
+        if (input && fs::equivalent(path, input, error))
+            throw Switch::Exception { Switch::Error::USAGE };
+    }
+
+    auto write = [&] (fs::path const& to) {
+        auto os = std::ofstream(to, std::ios::binary);
+        if (!os)
+            throw Switch::Exception { Switch::Error::OS_FAIL };
+        library.dump(os);
+        os.close();
+        if (!os)
+            throw Switch::Exception { Switch::Error::OS_FAIL };
+    };
+
+    if (fs::exists(path) && !fs::is_regular_file(path))
+        return write(path);
+
+    auto temporary = path;
+    temporary += ".tmp";
+    try {
+        write(temporary);
+        auto error = std::error_code {};
+        fs::rename(temporary, path, error);
+        if (error)
+            throw Switch::Exception { Switch::Error::OS_FAIL };
+    } catch (...) {
+        auto error = std::error_code {};
+        fs::remove(temporary, error);
+        throw;
+    }
+}
+
+/*
+ * in incremental mode dependencies of a target are cached next to it.
+ * target with a cache is known to be output of an earlier run, so it
+ * can be skipped when nothing it depends on has changed, or overwritten.
+ * errors found before the source is processed are thrown.
+ */
+int process(Job const& job, Switch const* prelude, Options const& options) {
+    auto incremental = options.incremental;
+
+    if (!std::filesystem::exists(job.source))
+        throw Switch::Exception { Switch::Error::SOURCE_FILE_MISSING };
+
+    auto cache = job.target;
+    cache += ".deps";
+
+    auto dependencies = Switch::Dependencies {};
+    if (incremental) {
+        dependencies.source  = digest(job.source);
+        dependencies.options = options.digest();
+    }
+
+    if (std::filesystem::exists(job.target)) {
+        auto cached = Switch::Dependencies {};
+        if (!incremental || !cached.load(cache))
+            throw Switch::Exception { Switch::Error::TARGET_FILE_EXISTS };
+        if (cached.source == dependencies.source
+                && cached.options == dependencies.options
+                && cached.current(prelude))
+            return 0;
+    }
+
+    if (job.target.has_parent_path())
+        std::filesystem::create_directories(job.target.parent_path());
+
+    auto fd = ::open(job.target.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    auto buffer = FileBuffer(fd, true);
+    auto os = std::ostream(&buffer);
+    if (fd < 0)
+        os.setstate(std::ios::badbit);
+    auto sw = Switch(job.source, os, prelude);
+    sw.dependencies = incremental ? &dependencies : nullptr;
+    sw.max_body = options.max_body;
+
+    auto code = 0;
+    try {
+        sw.process();
+    } catch (Switch::Exception const& ex) {
+        Switch::Error::log(sw, ex.what());
+        code = ex.error.code;
+    }
+
+    if (incremental) {
+        // errors are reported on every run, so such target is never current
+        if (!sw.clean())
+            dependencies.source = 0;
+        // without them the target would be taken for someone else's file
+        if (!dependencies.save(cache)) {
+            Switch::Error::log(sw, Switch::Error::DEPENDENCIES_FILE);
+            if (!code)
+                code = Switch::Error::DEPENDENCIES_FILE;
+        }
+    }
+    return code;
+}
+
+/*
+ * jobs are handed out to a pool of workers, exit code is the code
+ * of the first job that failed
+ */
+int batch(std::vector<Job> const& jobs, Switch const* prelude,
+          Options const& options) {
+    auto codes = std::vector<int>(jobs.size());
+    auto next  = std::atomic<std::size_t> { 0 };
+
+    // several files are processed, so errors say which one they are about
+    auto run = [&](Job const& job) -> int {
+        try {
+            return process(job, prelude, options);
+        } catch (Switch::Exception const& ex) {
+            static auto mutex = std::mutex {};
+            auto lock = std::lock_guard { mutex };
+            std::cerr << job.source.string() << ": " << ex.what() << std::endl;
+            return ex.error.code;
+        }
+    };
+
+    auto work = [&] {
+        for (auto i = next++; i < jobs.size(); i = next++)
+            codes[i] = run(jobs[i]);
+    };
+
+    auto threads = std::vector<std::thread> {};
+    auto workers = std::min<std::size_t>(options.jobs, jobs.size());
+    for (auto i = 1U; i < workers; ++i)
+        threads.emplace_back(work);
+    work();
+    for (auto& thread : threads)
+        thread.join();
+
+    for (auto code : codes)
+        if (code != 0)
+            return code;
+    return 0;
+}
+
+// bench/bench.cpp includes this file with a main of its own
+#ifndef MACROPROCESSOR_NO_MAIN
 int main (int argc, char* argv[]) try {
-    if (argc > 2) {
-        if (!std::filesystem::exists(argv[1]))
+    auto options = Options::parse(argc, argv);
+
+    auto null = NullBuffer {};
+    auto discard = std::ostream(&null);
+    // prelude is processed on top of the library, if there is one
+    auto library = std::unique_ptr<Switch> {};
+    if (options.library) {
+        if (!std::filesystem::exists(options.library))
             throw Switch::Exception { Switch::Error::SOURCE_FILE_MISSING };
 
-        if (std::filesystem::exists(argv[2]))
-            throw Switch::Exception { Switch::Error::TARGET_FILE_EXISTS };
+        library = std::make_unique<Switch>(options.library, discard);
+        library->load();
+    }
 
-        auto is = std::ifstream(argv[1]);
-        auto os = std::ofstream(argv[2]);
-        Switch(argv[1], is, os).run();
-    } else if (argc > 1) {
-        if (!std::filesystem::exists(argv[1]))
+    auto prelude = std::move(library);
+    if (options.prelude) {
+        if (!std::filesystem::exists(options.prelude))
             throw Switch::Exception { Switch::Error::SOURCE_FILE_MISSING };
 
-        auto is = std::ifstream(argv[1]);
-        Switch(argv[1], is, std::cout).run();
+        library = std::move(prelude);
+        prelude = std::make_unique<Switch>(options.prelude, discard,
+                                           library.get());
+        prelude->max_body = options.max_body;
+        prelude->run();
+    }
+
+    if (options.dump) {
+        dump(*prelude, options);
+        if (options.files.empty())
+            return 0;
+    }
+
+    auto stdout_buffer = FileBuffer(STDOUT_FILENO);
+    auto out = std::ostream(&stdout_buffer);
+
+    auto stats = Switch::Stats {};
+    stats.json = options.stats && options.stats == std::string_view("json");
+
+    auto const& files = options.files;
+    if (files.size() == 2 && !std::filesystem::is_directory(files[0])) {
+        // there's nothing to share between jobs
+        if (options.jobs_given)
+            throw Switch::Exception { Switch::Error::USAGE };
+        return process({ files[0], files[1] }, prelude.get(), options);
+    } else if (files.size() > 1) {
+        return batch(jobs(files), prelude.get(), options);
+    } else if (files.size() > 0) {
+        if (!std::filesystem::exists(files[0]))
+            throw Switch::Exception { Switch::Error::SOURCE_FILE_MISSING };
+
+        auto sw = Switch(files[0], out, prelude.get());
+        sw.stats = options.stats ? &stats : nullptr;
+        sw.max_body = options.max_body;
+        options.parallel ? sw.run_parallel(options.jobs) : sw.run();
     } else {
-        Switch("STDIN", std::cin, std::cout).run();
+        auto sw = Switch("STDIN", std::cin, out, prelude.get());
+        sw.stats = options.stats ? &stats : nullptr;
+        sw.max_body = options.max_body;
+        options.parallel ? sw.run_parallel(options.jobs) : sw.run();
     }
 } catch (Switch::Exception const& ex) {
     std::cerr << ex.what() << std::endl;
     std::exit(ex.error.code);
+} catch (std::exception const& ex) {
+    // like running out of memory, in any of the threads
+    std::cerr << ex.what() << std::endl;
+    std::exit(Switch::Error::OTHER);
 }
+#endif
@@ -63,7 +63,14 @@ public:
            // remove empty
            list.removeAll(QString {});
            list.sort();
+           // whatever isn't there anymore has to be cleared from the schedule
+           auto kept = QSet<QString> { list.begin(), list.end() };
+           auto gone = QStringList {};
+           for (auto const& name : originalModel->stringList())
+               if (!kept.contains(name))
+                   gone << name;
            originalModel->setStringList(list);
+           emit removed(gone);
            accept();
         });
         buttons->addWidget(sav);
@@ -72,6 +79,10 @@ public:
         layout->addWidget(box);
         setLayout(layout);
     }
+
+signals:
+    // names that were in the dictionary and got removed when saving
+    void removed(QStringList const& names);
 };
 
 #endif // DICTEDIT_H
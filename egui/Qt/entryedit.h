@@ -63,9 +63,9 @@ public:
                 class_->setCurrentIndex(-1);
                 teacher_->setCurrentIndex(-1);
             } else {
-                group_->setCurrentIndex(group_->findText(entry.group_));
-                class_->setCurrentIndex(class_->findText(entry.class_));
-                teacher_->setCurrentIndex(teacher_->findText(entry.teacher_));
+                group_->setCurrentIndex(group_->findText(schedule->groupName(entry.group_)));
+                class_->setCurrentIndex(class_->findText(schedule->className(entry.class_)));
+                teacher_->setCurrentIndex(teacher_->findText(schedule->teacherName(entry.teacher_)));
             }
         }
 
@@ -0,0 +1,548 @@
+#ifndef JSONLOADER_H
+#define JSONLOADER_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "schedule.h"
+
+// reads a timetable straight from the text, without building a QJsonDocument
+// first, and goes on after bad entries so every problem is reported at once
+//
+// {
+//     "rooms": [ "101", ... ], "groups": [ ... ], "classes": [ ... ], "teachers": [ ... ],
+//     "activities": [
+//          { "room": "101", "group": "1a", "class": "mat", "slot": 1, "day": 1, "teacher": "kowalski"},
+//     ]
+// }
+class JsonLoader {
+public:
+    struct Result {
+        Timetable timetable;
+        QStringList errors;
+        // false when the file isn't JSON at all, then there's no timetable
+        bool ok = false;
+    };
+
+    // progress gets how far into the file the reading is, in percent
+    static auto load(QByteArray const& json, std::function<void(int)> progress = {}) -> Result {
+        return JsonLoader { json, std::move(progress) }.run();
+    }
+
+private:
+    enum { MAX_ERRORS = 1000, MAX_DEPTH = 256 };
+
+    // names as they are in the file, interned before they can be looked up,
+    // since files we save have "activities" before all the dictionaries
+    struct Strings {
+        std::unordered_map<std::string_view, quint32> ids;
+        std::vector<std::string_view> names { std::string_view {} };
+        // names with escapes in them, everything else points into the file
+        std::deque<std::string> decoded;
+
+        auto id(std::string_view name, bool copy) -> quint32 {
+            if (auto it = ids.find(name); it != ids.end())
+                return it->second;
+            if (copy)
+                name = decoded.emplace_back(name);
+            auto id = quint32(names.size());
+            ids.emplace(name, id);
+            names.push_back(name);
+            return id;
+        }
+    };
+
+    // an activity waiting for the dictionaries, 0 is a missing name
+    struct Activity {
+        char const* at;
+        quint32 room, group, class_, teacher;
+        int day, slot;
+    };
+
+    char const* begin_;
+    char const* p;
+    char const* end_;
+
+    // set by the first syntax error, after which p is at the end so that
+    // everything unwinds without reading anything else
+    QString syntax;
+
+    QStringList errors;
+    int dropped = 0;
+
+    // lines are counted on demand, errors come mostly in order of the file
+    char const* counted;
+    int line = 1;
+
+    std::string scratch;
+    bool escaped = false;
+
+    Timetable::Names rooms, groups, classes, teachers;
+    Strings roomNames, groupNames, classNames, teacherNames;
+    std::vector<Activity> activities;
+
+    std::function<void(int)> progress;
+    int done = 0;
+
+    JsonLoader(QByteArray const& json, std::function<void(int)> progress_)
+        : begin_(json.constData())
+        , p(begin_)
+        , end_(begin_ + json.size())
+        , counted(begin_)
+        , progress(std::move(progress_))
+    {}
+
+    // activities are most of any file, so that's where it's reported from
+    auto report() -> void {
+        if (!progress || p == end_)
+            return;
+        if (auto percent = int((p - begin_) * qint64(100) / (end_ - begin_)); percent != done)
+            progress(done = percent);
+    }
+
+    auto lineOf(char const* at) -> int {
+        if (at < counted) {
+            counted = begin_;
+            line = 1;
+        }
+        line += int(std::count(counted, at, '\n'));
+        counted = at;
+        return line;
+    }
+
+    auto error(char const* at, QString const& message) -> void {
+        if (errors.size() < MAX_ERRORS)
+            errors << QStringLiteral("line %1: %2").arg(lineOf(at)).arg(message);
+        else
+            dropped++;
+    }
+
+    auto fail(QString const& message) -> void {
+        if (syntax.isNull()) {
+            auto column = int(p - std::find(std::make_reverse_iterator(p),
+                                            std::make_reverse_iterator(begin_), '\n').base()) + 1;
+            syntax = QStringLiteral("line %1, column %2: %3").arg(lineOf(p)).arg(column).arg(message);
+        }
+        p = end_;
+    }
+
+    auto ws() -> void {
+        while (p != end_ && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'))
+            p++;
+    }
+
+    auto peek() -> char {
+        ws();
+        return p != end_ ? *p : '\0';
+    }
+
+    auto consume(char c) -> bool {
+        if (peek() != c)
+            return false;
+        p++;
+        return true;
+    }
+
+    auto expect(char c) -> void {
+        if (!consume(c))
+            fail(QStringLiteral("expected '%1'").arg(QLatin1Char(c)));
+    }
+
+    static auto hex(char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    auto codeUnit() -> int {
+        if (end_ - p < 4)
+            return -1;
+        auto unit = 0;
+        for (auto i = 0; i < 4; i++) {
+            auto digit = hex(*p++);
+            if (digit < 0)
+                return -1;
+            unit = unit * 16 + digit;
+        }
+        return unit;
+    }
+
+    static auto utf8(std::string& out, char32_t c) -> void {
+        if (c < 0x80) {
+            out += char(c);
+        } else if (c < 0x800) {
+            out += char(0xc0 | c >> 6);
+            out += char(0x80 | (c & 0x3f));
+        } else if (c < 0x10000) {
+            out += char(0xe0 | c >> 12);
+            out += char(0x80 | (c >> 6 & 0x3f));
+            out += char(0x80 | (c & 0x3f));
+        } else {
+            out += char(0xf0 | c >> 18);
+            out += char(0x80 | (c >> 12 & 0x3f));
+            out += char(0x80 | (c >> 6 & 0x3f));
+            out += char(0x80 | (c & 0x3f));
+        }
+    }
+
+    // p is at the opening quote, the string points into the file unless it had
+    // escapes in it, then it's decoded into scratch and escaped is set
+    auto string() -> std::string_view {
+        auto start = ++p;
+        while (p != end_ && *p != '"' && *p != '\\' && static_cast<unsigned char>(*p) >= 0x20)
+            p++;
+        escaped = p != end_ && *p == '\\';
+        if (p != end_ && *p == '"')
+            return std::string_view(start, std::size_t(p++ - start));
+
+        scratch.assign(start, p);
+        while (p != end_ && *p != '"') {
+            if (static_cast<unsigned char>(*p) < 0x20)
+                break;
+            if (*p != '\\') {
+                scratch += *p++;
+                continue;
+            }
+            if (++p == end_)
+                break;
+            switch (auto c = *p++) {
+            case '"': case '\\': case '/': scratch += c; break;
+            case 'b': scratch += '\b'; break;
+            case 'f': scratch += '\f'; break;
+            case 'n': scratch += '\n'; break;
+            case 'r': scratch += '\r'; break;
+            case 't': scratch += '\t'; break;
+            case 'u': {
+                auto unit = codeUnit();
+                if (unit < 0) {
+                    fail("invalid \\u escape");
+                    return {};
+                }
+                auto c32 = char32_t(unit);
+                // surrogate pairs, a lone one becomes the replacement character
+                if (unit >= 0xd800 && unit < 0xdc00 && end_ - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+                    auto save = p;
+                    p += 2;
+                    if (auto low = codeUnit(); low >= 0xdc00 && low < 0xe000)
+                        c32 = 0x10000 + (char32_t(unit - 0xd800) << 10) + char32_t(low - 0xdc00);
+                    else
+                        p = save;
+                }
+                utf8(scratch, c32 >= 0xd800 && c32 < 0xe000 ? 0xfffd : c32);
+                break;
+            }
+            default:
+                fail("invalid escape in a string");
+                return {};
+            }
+        }
+        if (p == end_ || *p != '"') {
+            fail(p == end_ ? "unterminated string" : "control character in a string");
+            return {};
+        }
+        p++;
+        return scratch;
+    }
+
+    auto number() -> double {
+        auto start = p;
+        auto digits = [this] {
+            auto from = p;
+            while (p != end_ && *p >= '0' && *p <= '9')
+                p++;
+            return p != from;
+        };
+        if (p != end_ && *p == '-')
+            p++;
+        auto integer = true;
+        auto valid = digits();
+        if (valid && p != end_ && *p == '.') {
+            p++;
+            integer = false;
+            valid = digits();
+        }
+        if (valid && p != end_ && (*p == 'e' || *p == 'E')) {
+            p++;
+            integer = false;
+            if (p != end_ && (*p == '+' || *p == '-'))
+                p++;
+            valid = digits();
+        }
+        if (!valid) {
+            fail("invalid number");
+            return 0;
+        }
+        // slots and days are small, anything else goes the long way
+        if (integer && p - start < 10) {
+            auto value = 0;
+            for (auto c = start + (*start == '-'); c != p; c++)
+                value = value * 10 + (*c - '0');
+            return *start == '-' ? -value : value;
+        }
+        return QByteArray(start, int(p - start)).toDouble();
+    }
+
+    auto literal(char const* word) -> void {
+        auto length = std::char_traits<char>::length(word);
+        if (std::size_t(end_ - p) < length || std::string_view(p, length) != word)
+            return fail("invalid value");
+        p += length;
+    }
+
+    auto skip(int depth = 0) -> void {
+        if (depth > MAX_DEPTH)
+            return fail("nested too deeply");
+        switch (peek()) {
+        case '"':
+            string();
+            return;
+        case '{':
+            p++;
+            if (consume('}'))
+                return;
+            do {
+                if (peek() != '"')
+                    return fail("expected a key");
+                string();
+                expect(':');
+                skip(depth + 1);
+            } while (consume(','));
+            return expect('}');
+        case '[':
+            p++;
+            if (consume(']'))
+                return;
+            do
+                skip(depth + 1);
+            while (consume(','));
+            return expect(']');
+        case 't':
+            return literal("true");
+        case 'f':
+            return literal("false");
+        case 'n':
+            return literal("null");
+        case '\0':
+            return fail("expected a value");
+        default:
+            number();
+        }
+    }
+
+    // keys of an object, f is called at each value
+    template <typename F>
+    auto members(F const& f) -> void {
+        p++;
+        if (consume('}'))
+            return;
+        do {
+            if (peek() != '"')
+                return fail("expected a key");
+            auto key = string();
+            // keys are short, escaped ones are copied so values can use scratch
+            auto copy = std::string {};
+            if (escaped)
+                key = copy = key;
+            expect(':');
+            if (!syntax.isNull())
+                return;
+            f(key);
+        } while (consume(','));
+        expect('}');
+    }
+
+    auto dictionary(Timetable::Names& names, QString const& array) -> void {
+        names = Timetable::Names {};
+        if (peek() != '[') {
+            error(p, QStringLiteral("\"%1\" should be an array").arg(array));
+            return skip();
+        }
+        p++;
+        if (consume(']'))
+            return;
+        do {
+            if (peek() == '"') {
+                auto name = string();
+                names.id(QString::fromUtf8(name.data(), int(name.size())));
+            } else {
+                error(p, QStringLiteral("elements of array %1 should be strings").arg(array));
+                skip();
+            }
+        } while (consume(','));
+        expect(']');
+    }
+
+    auto activity() -> void {
+        if (peek() != '{') {
+            error(p, "elements of \"activities\" should be objects");
+            return skip();
+        }
+
+        auto a = Activity { p, 0, 0, 0, 0, 0, 0 };
+        auto nan = std::numeric_limits<double>::quiet_NaN();
+        auto day = nan, slot = nan;
+        auto text = [this] (Strings& strings, quint32& id) {
+            if (peek() != '"')
+                return skip();
+            auto s = string();
+            id = strings.id(s, escaped);
+        };
+        auto value = [this] (double& to) {
+            auto c = peek();
+            if (c != '-' && (c < '0' || c > '9'))
+                return skip();
+            to = number();
+        };
+        members([&] (std::string_view key) {
+            if (key == "room")
+                text(roomNames, a.room);
+            else if (key == "group")
+                text(groupNames, a.group);
+            else if (key == "class")
+                text(classNames, a.class_);
+            else if (key == "teacher")
+                text(teacherNames, a.teacher);
+            else if (key == "slot")
+                value(slot);
+            else if (key == "day")
+                value(day);
+            else
+                skip();
+        });
+        if (!syntax.isNull())
+            return;
+
+        if (!a.room)
+            return error(a.at, "\"room\" should be a string");
+        if (!a.group)
+            return error(a.at, "\"group\" should be a string");
+        if (!a.class_)
+            return error(a.at, "\"class\" should be a string");
+        if (std::isnan(slot))
+            return error(a.at, "\"slot\" should be a number");
+        if (std::isnan(day))
+            return error(a.at, "\"day\" should be a number");
+        if (!a.teacher)
+            return error(a.at, "\"teacher\" should be a string");
+
+        if (day != std::floor(day) || day < 0 || day >= Timetable::NUM_DAYS)
+            return error(a.at, "\"day\" should be from 0 to 4 (0 - Monday, 4 - Friday)");
+        if (slot != std::floor(slot) || slot < 0 || slot >= Timetable::NUM_TIMES)
+            return error(a.at, "\"slot\" should be from 0 - 8 (0 - 08:00-08:45, 8 - 15:30-16:15)");
+        a.day = int(day);
+        a.slot = int(slot);
+
+        activities.push_back(a);
+    }
+
+    auto document() -> void {
+        if (peek() != '{')
+            return fail("expected an object");
+        members([this] (std::string_view key) {
+            if (key == "rooms")
+                dictionary(rooms, "rooms");
+            else if (key == "groups")
+                dictionary(groups, "groups");
+            else if (key == "classes")
+                dictionary(classes, "classes");
+            else if (key == "teachers")
+                dictionary(teachers, "teachers");
+            else if (key == "activities") {
+                if (peek() != '[') {
+                    error(p, "\"activities\" should be an array");
+                    return skip();
+                }
+                activities.clear();
+                p++;
+                if (consume(']'))
+                    return;
+                do {
+                    activity();
+                    report();
+                } while (consume(','));
+                expect(']');
+            } else
+                skip();
+        });
+        if (peek() != '\0')
+            fail("unexpected text after the object");
+    }
+
+    // names from the file to ids of the dictionaries, 0 when not declared
+    static auto resolve(Strings const& strings, Timetable::Names const& names) -> std::vector<quint32> {
+        auto ids = std::vector<quint32>(strings.names.size(), 0);
+        for (auto i = std::size_t { 1 }; i < ids.size(); i++)
+            ids[i] = names.find(QString::fromUtf8(strings.names[i].data(), int(strings.names[i].size())));
+        return ids;
+    }
+
+    auto run() -> Result {
+        auto result = Result {};
+        document();
+        if (!syntax.isNull()) {
+            result.errors << syntax;
+            return result;
+        }
+
+        auto required = [this] (Timetable::Names const& names, char const* array) {
+            if (names.size() > 1)
+                return true;
+            errors << QStringLiteral("required array \"%1\" is empty or doesn't exist").arg(array);
+            return false;
+        };
+        // each is checked so all the missing ones get reported
+        auto complete = required(rooms, "rooms") & required(groups, "groups")
+                      & required(classes, "classes") & required(teachers, "teachers");
+
+        result.timetable = Timetable { rooms, groups, classes, teachers };
+        // no activity could be valid without all of them
+        if (complete) {
+            auto roomIds = resolve(roomNames, rooms);
+            auto groupIds = resolve(groupNames, groups);
+            auto classIds = resolve(classNames, classes);
+            auto teacherIds = resolve(teacherNames, teachers);
+
+            auto undeclared = [this] (Activity const& a, Strings const& strings, quint32 id, char const* key, char const* array) {
+                auto name = strings.names[id];
+                error(a.at, QStringLiteral("\"%1\" %2 for this activity wasn't declared in the \"%3\" array")
+                      .arg(key).arg(QString::fromUtf8(name.data(), int(name.size()))).arg(array));
+            };
+
+            for (auto const& a : activities) {
+                auto entry = Timetable::TimeSlot { groupIds[a.group], classIds[a.class_], teacherIds[a.teacher] };
+                if (!roomIds[a.room])
+                    undeclared(a, roomNames, a.room, "room", "rooms");
+                else if (!entry.group_)
+                    undeclared(a, groupNames, a.group, "group", "groups");
+                else if (!entry.class_)
+                    undeclared(a, classNames, a.class_, "class", "classes");
+                else if (!entry.teacher_)
+                    undeclared(a, teacherNames, a.teacher, "teacher", "teachers");
+                else
+                    // when activities clash the later one wins, same as when editing
+                    result.timetable.place(roomIds[a.room], a.day, a.slot, entry);
+            }
+        }
+
+        if (dropped)
+            errors << QStringLiteral("and %1 more").arg(dropped);
+        result.errors = errors;
+        result.ok = true;
+        return result;
+    }
+};
+
+#endif // JSONLOADER_H
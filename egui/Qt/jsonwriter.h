@@ -0,0 +1,165 @@
+#ifndef JSONWRITER_H
+#define JSONWRITER_H
+
+#include <QByteArray>
+#include <QSaveFile>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <algorithm>
+#include <functional>
+
+#include "schedule.h"
+
+// writes a timetable out like QJsonDocument::toJson would, keys sorted and
+// indented by four, but straight into the file instead of building a document
+class JsonWriter {
+public:
+    // returns what went wrong, or a null string when everything got saved
+    static auto save(QString const& filename,
+                     Timetable const& timetable,
+                     QStringList const& rooms,
+                     QStringList const& groups,
+                     QStringList const& classes,
+                     QStringList const& teachers,
+                     std::function<void(int)> const& progress = {}) -> QString {
+        // the old file stays as it was if anything goes wrong
+        auto file = QSaveFile { filename };
+        if (!file.open(QIODevice::WriteOnly))
+            return QStringLiteral("couldn't open %1 for writing").arg(filename);
+
+        auto writer = JsonWriter { file };
+        writer.out += "{\n";
+        writer.activities(timetable, progress);
+        writer.out += ",\n";
+        writer.array("classes", classes);
+        writer.out += ",\n";
+        writer.array("groups", groups);
+        writer.out += ",\n";
+        writer.array("rooms", rooms);
+        writer.out += ",\n";
+        writer.array("teachers", teachers);
+        writer.out += "\n}\n";
+        writer.flush();
+
+        if (!file.commit())
+            return QStringLiteral("couldn't write %1: %2").arg(filename, file.errorString());
+        return QString {};
+    }
+
+private:
+    enum { CHUNK = 1 << 20 };
+
+    QSaveFile& file;
+    QByteArray out;
+
+    JsonWriter(QSaveFile& file)
+        : file(file) {
+        out.reserve(CHUNK + CHUNK / 4);
+    }
+
+    // errors are remembered by the file and show up when committing
+    auto flush() -> void {
+        file.write(out);
+        out.clear();
+        out.reserve(CHUNK + CHUNK / 4);
+    }
+
+    static auto quote(QString const& s) -> QByteArray {
+        static char const digits[] = "0123456789abcdef";
+        auto quoted = QByteArray { "\"" };
+        for (auto c : s.toUtf8()) {
+            switch (c) {
+            case '"':  quoted += "\\\""; break;
+            case '\\': quoted += "\\\\"; break;
+            case '\b': quoted += "\\b"; break;
+            case '\f': quoted += "\\f"; break;
+            case '\n': quoted += "\\n"; break;
+            case '\r': quoted += "\\r"; break;
+            case '\t': quoted += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    quoted += "\\u00";
+                    quoted += digits[c >> 4];
+                    quoted += digits[c & 0xf];
+                } else {
+                    quoted += c;
+                }
+            }
+        }
+        quoted += '"';
+        return quoted;
+    }
+
+    // every name quoted once, activities only refer to them by id
+    static auto quote(Timetable::Names const& names) -> QVector<QByteArray> {
+        auto quoted = QVector<QByteArray> {};
+        quoted.reserve(names.size());
+        for (auto id = 0; id < names.size(); id++)
+            quoted.push_back(quote(names.name(quint32(id))));
+        return quoted;
+    }
+
+    auto array(char const* key, QStringList const& names) -> void {
+        out += "    \"";
+        out += key;
+        out += "\": [\n";
+        for (auto i = 0; i < names.size(); i++) {
+            out += "        ";
+            out += quote(names[i]);
+            out += i + 1 < names.size() ? ",\n" : "\n";
+        }
+        out += "    ]";
+    }
+
+    auto activities(Timetable const& t, std::function<void(int)> const& progress) -> void {
+        auto rooms = quote(t.rooms);
+        auto groups = quote(t.groups);
+        auto classes = quote(t.classes);
+        auto teachers = quote(t.teachers);
+
+        // rooms by name, as they always were saved
+        auto ids = QVector<quint32> {};
+        for (auto id = 1; id < t.rooms.size(); id++)
+            ids.push_back(quint32(id));
+        std::sort(ids.begin(), ids.end(), [&t] (auto a, auto b) {
+            return t.rooms.name(a) < t.rooms.name(b);
+        });
+
+        out += "    \"activities\": [\n";
+        auto first = true;
+        auto done = 0;
+        for (auto i = 0; i < ids.size(); i++) {
+            auto id = ids[i];
+            for (auto day = 0; day < Timetable::NUM_DAYS; day++)
+                for (auto slot = 0; slot < Timetable::NUM_TIMES; slot++) {
+                    auto const& entry = t.slot(id, day, slot);
+                    if (entry.isEmpty())
+                        continue;
+                    out += first ? "        {\n" : ",\n        {\n";
+                    first = false;
+                    out += "            \"class\": ";
+                    out += classes[int(entry.class_)];
+                    out += ",\n            \"day\": ";
+                    out += QByteArray::number(day);
+                    out += ",\n            \"group\": ";
+                    out += groups[int(entry.group_)];
+                    out += ",\n            \"room\": ";
+                    out += rooms[int(id)];
+                    out += ",\n            \"slot\": ";
+                    out += QByteArray::number(slot);
+                    out += ",\n            \"teacher\": ";
+                    out += teachers[int(entry.teacher_)];
+                    out += "\n        }";
+                }
+            if (out.size() >= CHUNK)
+                flush();
+            if (auto percent = int((i + 1) * qint64(100) / ids.size()); progress && percent != done)
+                progress(done = percent);
+        }
+        out += first ? "    ]" : "\n    ]";
+    }
+};
+
+#endif // JSONWRITER_H
@@ -6,20 +6,25 @@
 #include "schedule.h"
 #include "dictedit.h"
 #include "entryedit.h"
+#include "jsonloader.h"
+#include "jsonwriter.h"
 
 #include <QAbstractTableModel>
 #include <QDebug>
 #include <QDialog>
 #include <QFile>
 #include <QFileDialog>
-#include <QJsonDocument>
-#include <QJsonArray>
-#include <QJsonObject>
+#include <QFutureWatcher>
 #include <QListView>
 #include <QMainWindow>
 #include <QMessageBox>
+#include <QProgressDialog>
 #include <QPushButton>
 #include <QStringListModel>
+#include <QThreadPool>
+#include <QtConcurrent>
+
+#include <functional>
 
 class MainWindow : public QMainWindow {
     Q_OBJECT
@@ -65,38 +70,33 @@ public:
 
         connect(ui->action_Classes, &QAction::triggered, this, [this] {
             auto de = new DictEdit { &classes, this };
-            connect(de, &QDialog::accepted, ui->tableView->model(), [this] {
-                auto schedule = static_cast<ScheduleModel*>(ui->tableView->model());
-                schedule->removeInvalidClasses(classes.stringList());
-            });
+            connect(de, &DictEdit::removed,
+                    static_cast<ScheduleModel*>(ui->tableView->model()),
+                    &ScheduleModel::removeClasses);
             de->show();
         });
 
         connect(ui->action_Groups, &QAction::triggered, this, [this] {
             auto de = new DictEdit { &groups, this };
-            connect(de, &QDialog::accepted, ui->tableView->model(), [this] {
-                auto schedule = static_cast<ScheduleModel*>(ui->tableView->model());
-                schedule->removeInvalidGroups(groups.stringList());
-            });
+            connect(de, &DictEdit::removed,
+                    static_cast<ScheduleModel*>(ui->tableView->model()),
+                    &ScheduleModel::removeGroups);
             de->show();
         });
 
         connect(ui->action_Rooms, &QAction::triggered, this, [this] {
             auto de = new DictEdit { &rooms, this };
-            connect(de, &QDialog::accepted, ui->tableView->model(), [this] {
-                auto schedule = static_cast<ScheduleModel*>(ui->tableView->model());
-                auto rooms    = static_cast<QStringListModel*>(ui->comboBox->model());
-                schedule->removeInvalidRooms(rooms->stringList());
-            });
+            connect(de, &DictEdit::removed,
+                    static_cast<ScheduleModel*>(ui->tableView->model()),
+                    &ScheduleModel::removeRooms);
             de->show();
         });
 
         connect(ui->action_Teachers, &QAction::triggered, this, [this] {
             auto de = new DictEdit { &teachers, this };
-            connect(de, &QDialog::accepted, ui->tableView->model(), [this] {
-                auto schedule = static_cast<ScheduleModel*>(ui->tableView->model());
-                schedule->removeInvalidTeachers(teachers.stringList());
-            });
+            connect(de, &DictEdit::removed,
+                    static_cast<ScheduleModel*>(ui->tableView->model()),
+                    &ScheduleModel::removeTeachers);
             de->show();
         });
 
@@ -122,83 +122,120 @@ public:
     }
 
     ~MainWindow() {
+        // a load or save could still be reporting to a dialog of ours
+        QThreadPool::globalInstance()->waitForDone();
         delete ui;
     }
 
-    bool loadJson(QString const& filename) {
-        auto file = QFile { filename };
-        if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-            qDebug() << QStringLiteral("couldn't open file: %1").arg(filename);
-            return false;
-        }
-        auto object = QJsonDocument::fromJson(file.readAll()).object();
-        file.close();
-
-        auto schedule = static_cast<ScheduleModel*>(ui->tableView->model());
-
-        auto toStringList = [] (auto const* arrayName, auto const& jsonArray) {
-            auto list = QStringList {};
-            for (auto const& elem : jsonArray) {
-                if (!elem.isString()) {
-                    qDebug() << QStringLiteral("elements of array %1 should be strings").arg(arrayName);
-                    continue;
-                }
-                list << elem.toString();
-            }
-            return list;
-        };
+    // loading and saving run on another thread, the window just waits
+    // for them behind a progress dialog
+    void loadJson(QString const& filename) {
+        auto dialog = busy(QStringLiteral("loading %1").arg(filename));
+        auto watcher = new QFutureWatcher<JsonLoader::Result> { this };
+        connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher, dialog, filename] {
+            auto result = watcher->result();
+            watcher->deleteLater();
+            done(dialog);
+
+            if (!result.errors.empty())
+                report(filename, result.errors);
+            if (!result.ok)
+                return;
+
+            // dictionaries come out of the timetable, without the duplicates
+            auto const& timetable = result.timetable;
+            rooms.setStringList(timetable.rooms.list());
+            groups.setStringList(timetable.groups.list());
+            classes.setStringList(timetable.classes.list());
+            teachers.setStringList(timetable.teachers.list());
 
-        auto rooms_ = object["rooms"].toArray();
-        rooms.setStringList(toStringList("rooms", rooms_));
-        if (rooms.stringList().empty())
-            qDebug() << "required array \"rooms\" is empty or doesn't exist";
-
-        auto groups_ = object["groups"].toArray();
-        groups.setStringList(toStringList("groups", groups_));
-        if (groups.stringList().empty())
-            qDebug() << "required array \"groups\" is empty or doesn't exist";
-
-        auto classes_ = object["classes"].toArray();
-        classes.setStringList(toStringList("classes", classes_));
-        if (classes.stringList().empty())
-            qDebug() << "required array \"classes\" is empty or doesn't exist";
-
-        auto teachers_ = object["teachers"].toArray();
-        teachers.setStringList(toStringList("teachers", teachers_));
-        if (teachers.stringList().empty())
-            qDebug() << "required array \"teachers\" is empty or doesn't exist";
-
-        // activity from JSON also needs lists of entries that are allowed to exist
-        schedule->activitiesFromJson(
-            object["activities"].toArray(),
-            rooms.stringList(),
-            groups.stringList(),
-            classes.stringList(),
-            teachers.stringList()
-        );
-        return true;
+            static_cast<ScheduleModel*>(ui->tableView->model())->setTimetable(std::move(result.timetable));
+        });
+        watcher->setFuture(QtConcurrent::run([filename, progress = progressOf(dialog)] {
+            auto file = QFile { filename };
+            if (!file.open(QIODevice::ReadOnly)) {
+                auto result = JsonLoader::Result {};
+                result.errors << QStringLiteral("couldn't open file: %1").arg(filename);
+                return result;
+            }
+            return JsonLoader::load(file.readAll(), progress);
+        }));
     }
 
-    bool saveJson(QString const& filename) {
-        auto object          = QJsonObject {};
-        object["rooms"]      = QJsonArray::fromStringList(rooms.stringList());
-        object["groups"]     = QJsonArray::fromStringList(groups.stringList());
-        object["classes"  ]  = QJsonArray::fromStringList(classes.stringList());
-        object["teachers"]   = QJsonArray::fromStringList(teachers.stringList());
-        object["activities"] = static_cast<ScheduleModel*>(ui->tableView->model())->activitiesToJson();
-
-        auto file = QFile { filename };
-        if (!file.open(QIODevice::WriteOnly)) {
-            qDebug() << QStringLiteral("couldn't open %1 for writing").arg(filename);
-            return false;
-        }
-        file.write(QJsonDocument(object).toJson());
-        return true;
+    void saveJson(QString const& filename) {
+        auto dialog = busy(QStringLiteral("saving %1").arg(filename));
+        auto watcher = new QFutureWatcher<QString> { this };
+        connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher, dialog, filename] {
+            if (auto error = watcher->result(); !error.isNull())
+                report(filename, { error });
+            watcher->deleteLater();
+            done(dialog);
+        });
+        // copies are cheap, everything in them is shared until it's changed
+        watcher->setFuture(QtConcurrent::run([
+            filename,
+            timetable = static_cast<ScheduleModel*>(ui->tableView->model())->timetable(),
+            rooms     = rooms.stringList(),
+            groups    = groups.stringList(),
+            classes   = classes.stringList(),
+            teachers  = teachers.stringList(),
+            progress  = progressOf(dialog)
+        ] {
+            return JsonWriter::save(filename, timetable, rooms, groups, classes, teachers, progress);
+        }));
     }
 
 private:
     Ui::MainWindow *ui;
 
+    // modal and shown right away, so the timetable can't change and no other
+    // load or save can start while one runs. it stays up, at 100% if need
+    // be, until the worker is done.
+    auto busy(QString const& label) -> QProgressDialog* {
+        ui->action_Load->setEnabled(false);
+        ui->action_Save->setEnabled(false);
+
+        auto dialog = new QProgressDialog { label, QString {}, 0, 100, this };
+        dialog->setWindowModality(Qt::WindowModal);
+        dialog->setCancelButton(nullptr);
+        dialog->setAutoClose(false);
+        dialog->setAutoReset(false);
+        dialog->setMinimumDuration(0);
+        dialog->setValue(0);
+        dialog->show();
+        return dialog;
+    }
+
+    auto done(QProgressDialog* dialog) -> void {
+        dialog->deleteLater();
+        ui->action_Load->setEnabled(true);
+        ui->action_Save->setEnabled(true);
+    }
+
+    // called from the worker thread, the dialog is only touched through the
+    // event loop and it isn't deleted before the worker is done
+    static auto progressOf(QProgressDialog* dialog) -> std::function<void(int)> {
+        return [dialog] (int percent) {
+            QMetaObject::invokeMethod(dialog, "setValue", Qt::QueuedConnection, Q_ARG(int, percent));
+        };
+    }
+
+    // all problems with a file at once instead of one popup each
+    auto report(QString const& filename, QStringList const& errors) -> void {
+        qDebug().noquote() << errors.join('\n');
+        auto box = new QMessageBox {
+            QMessageBox::Warning,
+            "planner",
+            QStringLiteral("there were problems with %1").arg(filename),
+            QMessageBox::Ok,
+            this
+        };
+        box->setInformativeText(errors.first());
+        box->setDetailedText(errors.join('\n'));
+        box->setAttribute(Qt::WA_DeleteOnClose);
+        box->show();
+    }
+
     QStringListModel rooms, groups, classes, teachers;
 };
 
@@ -1,4 +1,4 @@
-QT       += core gui
+QT       += core gui concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -14,6 +14,8 @@ SOURCES += \
 HEADERS += \
     dictedit.h \
     entryedit.h \
+    jsonloader.h \
+    jsonwriter.h \
     mainwindow.h \
     schedule.h
 
@@ -6,37 +6,264 @@
 #include <QDebug>
 #include <QDialog>
 #include <QFile>
+#include <QHash>
 #include <QHBoxLayout>
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QLabel>
-#include <QMap>
 #include <QString>
 #include <QStyledItemDelegate>
 #include <QVector>
 
-#include <array>
-
-class ScheduleModel : public QAbstractTableModel {
-    Q_OBJECT
+#include <algorithm>
+#include <utility>
 
+// everything there is in a schedule without the model around it, so it can
+// be built somewhere else (like when loading) and then handed to the model
+class Timetable {
 public:
+    enum { NUM_DAYS = 5, NUM_TIMES = 9, NUM_SLOTS = NUM_DAYS * NUM_TIMES };
+
+    // names are interned, a slot only holds their ids and 0 stands for no one
     struct TimeSlot {
-        QString group_, class_, teacher_;
+        quint32 group_ = 0, class_ = 0, teacher_ = 0;
         auto isEmpty() const -> bool
-        { return group_.isEmpty() && class_.isEmpty() && teacher_.isEmpty(); }
+        { return !group_ && !class_ && !teacher_; }
         auto clear() -> void
-        { group_.clear(); class_.clear(); teacher_.clear(); }
+        { *this = TimeSlot {}; }
     };
 
+    // ids are handed out in order of first appearance, when loading that's the
+    // order of the dictionaries so names don't change ids while they're in use
+    class Names {
+        QStringList names_ { QString {} };
+        QHash<QString, quint32> ids_;
+
+    public:
+        auto reset(QStringList const& names) -> void {
+            names_ = QStringList { QString {} };
+            ids_.clear();
+            ids_.reserve(names.size());
+            for (auto const& name : names)
+                id(name);
+        }
+
+        auto id(QString const& name) -> quint32 {
+            if (name.isEmpty())
+                return 0;
+            if (auto it = ids_.constFind(name); it != ids_.constEnd())
+                return *it;
+            auto id = quint32(names_.size());
+            ids_.insert(name, id);
+            names_.append(name);
+            return id;
+        }
+
+        // 0 for names that were never interned
+        auto find(QString const& name) const -> quint32 {
+            return ids_.value(name, 0);
+        }
+
+        auto name(quint32 id) const -> QString const& {
+            return names_.at(int(id));
+        }
+
+        auto size() const -> int {
+            return int(names_.size());
+        }
+
+        // every name, in order of the ids
+        auto list() const -> QStringList {
+            return names_.mid(1);
+        }
+    };
+
+    Names rooms, groups, classes, teachers;
+
+    Timetable() = default;
+
+    Timetable(Names rooms_, Names groups_, Names classes_, Names teachers_)
+        : rooms(std::move(rooms_))
+        , groups(std::move(groups_))
+        , classes(std::move(classes_))
+        , teachers(std::move(teachers_))
+        , slots_(rooms.size() * NUM_SLOTS)
+        , groupRooms(groups.size() * NUM_SLOTS, 0)
+        , teacherRooms(teachers.size() * NUM_SLOTS, 0)
+        , classFirst(classes.size(), -1)
+        , classNext(slots_.size(), -1)
+        , classPrev(slots_.size(), -1)
+    {}
+
+    static auto at(quint32 id, int day, int time) -> int {
+        return int(id) * NUM_SLOTS + day * NUM_TIMES + time;
+    }
+
+    auto slot(quint32 room, int day, int time) const -> TimeSlot const& {
+        return slots_[at(room, day, time)];
+    }
+
+    // interning grows the arrays indexed by the kind of id
+    auto roomId(QString const& name) -> quint32 {
+        auto id = rooms.id(name);
+        if (slots_.size() < rooms.size() * NUM_SLOTS) {
+            slots_.resize(rooms.size() * NUM_SLOTS);
+            classNext.resize(slots_.size());
+            classPrev.resize(slots_.size());
+        }
+        return id;
+    }
+
+    auto groupId(QString const& name) -> quint32 {
+        return intern(groups, name, groupRooms);
+    }
+
+    auto classId(QString const& name) -> quint32 {
+        auto id = classes.id(name);
+        while (classFirst.size() < classes.size())
+            classFirst.append(-1);
+        return id;
+    }
+
+    auto teacherId(QString const& name) -> quint32 {
+        return intern(teachers, name, teacherRooms);
+    }
+
+    auto vacate(quint32 room, int day, int time) -> void {
+        auto cell = at(room, day, time);
+        auto& slot = slots_[cell];
+        if (slot.group_)
+            groupRooms[at(slot.group_, day, time)] = 0;
+        if (slot.teacher_)
+            teacherRooms[at(slot.teacher_, day, time)] = 0;
+        if (slot.class_)
+            unlink(cell);
+        slot.clear();
+    }
+
+    auto place(quint32 room, int day, int time, TimeSlot const& entry) -> void {
+        // no one can be at two places at the same time, being nowhere is
+        // room 0 and vacating that doesn't do anything
+        vacate(room, day, time);
+        if (entry.group_)
+            vacate(groupRooms[at(entry.group_, day, time)], day, time);
+        if (entry.teacher_)
+            vacate(teacherRooms[at(entry.teacher_, day, time)], day, time);
+
+        slots_[at(room, day, time)] = entry;
+        if (entry.class_)
+            link(at(room, day, time));
+        if (entry.group_)
+            groupRooms[at(entry.group_, day, time)] = room;
+        if (entry.teacher_)
+            teacherRooms[at(entry.teacher_, day, time)] = room;
+    }
+
+    // these clear every cell with the given id and tell f about each of them
+    template <typename F>
+    auto removeClass(quint32 id, F const& f) -> void {
+        while (classFirst[int(id)] != -1) {
+            auto cell = classFirst[int(id)];
+            auto room = quint32(cell / NUM_SLOTS);
+            auto day = cell % NUM_SLOTS / NUM_TIMES, time = cell % NUM_TIMES;
+            vacate(room, day, time);
+            f(room, day, time);
+        }
+    }
+
+    template <typename F>
+    auto removeGroup(quint32 id, F const& f) -> void {
+        remove(groupRooms, id, f);
+    }
+
+    template <typename F>
+    auto removeRoom(quint32 id, F const& f) -> void {
+        for (auto day = 0; day < NUM_DAYS; day++)
+            for (auto time = 0; time < NUM_TIMES; time++)
+                if (!slot(id, day, time).isEmpty()) {
+                    vacate(id, day, time);
+                    f(id, day, time);
+                }
+    }
+
+    template <typename F>
+    auto removeTeacher(quint32 id, F const& f) -> void {
+        remove(teacherRooms, id, f);
+    }
+
+private:
+    // every room's week one after another, indexed by room id; room 0 is
+    // the week shown when no room is selected and always stays empty
+    QVector<TimeSlot> slots_ = QVector<TimeSlot>(NUM_SLOTS);
+
+    // which room every group and teacher is in at a given time, so that clashes
+    // can be found without going through every room, laid out like slots_
+    QVector<quint32> groupRooms = QVector<quint32>(NUM_SLOTS, 0);
+    QVector<quint32> teacherRooms = QVector<quint32>(NUM_SLOTS, 0);
+
+    // cells of every class linked through the timetable, so removing a class
+    // only visits its own cells, -1 ends a list
+    QVector<int> classFirst = QVector<int>(1, -1);
+    QVector<int> classNext = QVector<int>(NUM_SLOTS, -1);
+    QVector<int> classPrev = QVector<int>(NUM_SLOTS, -1);
+
+    static auto intern(Names& names, QString const& name, QVector<quint32>& index) -> quint32 {
+        auto id = names.id(name);
+        if (index.size() < names.size() * NUM_SLOTS)
+            index.resize(names.size() * NUM_SLOTS);
+        return id;
+    }
+
+    auto link(int cell) -> void {
+        auto& first = classFirst[int(slots_[cell].class_)];
+        classPrev[cell] = -1;
+        classNext[cell] = first;
+        if (first != -1)
+            classPrev[first] = cell;
+        first = cell;
+    }
+
+    auto unlink(int cell) -> void {
+        auto prev = classPrev[cell], next = classNext[cell];
+        if (prev != -1)
+            classNext[prev] = next;
+        else
+            classFirst[int(slots_[cell].class_)] = next;
+        if (next != -1)
+            classPrev[next] = prev;
+    }
+
+    template <typename F>
+    auto remove(QVector<quint32> const& index, quint32 id, F const& f) -> void {
+        for (auto day = 0; day < NUM_DAYS; day++)
+            for (auto time = 0; time < NUM_TIMES; time++)
+                if (auto room = index[at(id, day, time)]) {
+                    vacate(room, day, time);
+                    f(room, day, time);
+                }
+    }
+};
+
+class ScheduleModel : public QAbstractTableModel {
+    Q_OBJECT
+
+public:
+    using TimeSlot = Timetable::TimeSlot;
+
 private:
 
-    enum { NUM_DAYS = 5, NUM_TIMES = 9 };
-    using Day  = std::array<TimeSlot, NUM_TIMES>;
-    using Week = std::array<Day, NUM_DAYS>;
+    enum { NUM_DAYS = Timetable::NUM_DAYS, NUM_TIMES = Timetable::NUM_TIMES };
 
-    QMap<QString, Week> schedules;
+    Timetable timetable_;
+
+    quint32 current = 0;
+
+    // refreshes a cell if it's in the room on display
+    auto refresh(quint32 room, int day, int time) -> void {
+        if (room == current)
+            emit dataChanged(index(time, day), index(time, day), { Qt::DisplayRole });
+    }
 
 public:
     QString room;
@@ -44,18 +271,44 @@ public:
     using QAbstractTableModel::QAbstractTableModel;
 
     auto setEntry(QString const& g, QString const& c, QString const& t, int row, int column) -> void {
-        if (row < NUM_TIMES || column < NUM_DAYS) {
-            for (auto& schedule : schedules)
-                // no one can be at two places at the same time
-                if (auto& entry = schedule[column][row]; entry.group_ == g || entry.teacher_ == t)
-                    entry.clear();
-            schedules[room][column][row] = { g, c, t };
+        if (row >= 0 && row < NUM_TIMES && column >= 0 && column < NUM_DAYS && !room.isEmpty()) {
+            // clashes can only be at the same time, so in the current room it's this very cell
+            current = timetable_.roomId(room);
+            timetable_.place(current, column, row, {
+                timetable_.groupId(g),
+                timetable_.classId(c),
+                timetable_.teacherId(t)
+            });
             emit dataChanged(index(row, column), index(row, column), { Qt::DisplayRole });
         }
     }
 
     auto entry(int row, int column) const -> TimeSlot {
-        return schedules[room][column][row];
+        return timetable_.slot(current, column, row);
+    }
+
+    auto groupName(quint32 id) const -> QString const& {
+        return timetable_.groups.name(id);
+    }
+
+    auto className(quint32 id) const -> QString const& {
+        return timetable_.classes.name(id);
+    }
+
+    auto teacherName(quint32 id) const -> QString const& {
+        return timetable_.teachers.name(id);
+    }
+
+    auto timetable() const -> Timetable const& {
+        return timetable_;
+    }
+
+    // everything shown changes so views have to start over
+    auto setTimetable(Timetable timetable) -> void {
+        beginResetModel();
+        std::swap(timetable_, timetable);
+        current = timetable_.rooms.find(room);
+        endResetModel();
     }
 
     auto rowCount(QModelIndex const& parent = QModelIndex())
@@ -72,20 +325,20 @@ public:
 
     auto data(QModelIndex const& index, int role = Qt::DisplayRole)
     const -> QVariant override {
-        if (!index.isValid() || index.row() > 10 || index.column() > 5)
+        if (!index.isValid() || index.row() >= NUM_TIMES || index.column() >= NUM_DAYS)
             return QVariant {};
 
         if (role != Qt::DisplayRole)
             return QVariant {};
 
-        auto slot = schedules[room][index.column()][index.row()];
+        auto const& slot = timetable_.slot(current, index.column(), index.row());
 
         if (slot.isEmpty())
             return QString {};
         else
             return QStringLiteral("%1: %2")
-                .arg(slot.group_)
-                .arg(slot.class_);
+                .arg(timetable_.groups.name(slot.group_))
+                .arg(timetable_.classes.name(slot.class_));
     }
 
     auto headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole)
@@ -118,162 +371,41 @@ public:
         return QVariant {};
     }
 
-    void removeInvalidClasses(QStringList const& cs) {
-        // here we could try some more elaborate logic to only update the view
-        // when necessary and only the parts that changed but why bother
-        for (auto& schedule : schedules)
-            for (auto& day : schedule)
-                for (auto& slot : day)
-                    if (!cs.contains(slot.class_))
-                        slot.clear();
-        emit dataChanged(index(0, 0), index(NUM_TIMES - 1, NUM_DAYS - 1), { Qt::DisplayRole  });
-    }
-
-    void removeInvalidGroups(QStringList const& gs) {
-        for (auto& schedule : schedules)
-            for (auto& day : schedule)
-                for (auto& slot : day)
-                    if (!gs.contains(slot.group_))
-                        slot.clear();
-        emit dataChanged(index(0, 0), index(NUM_TIMES - 1, NUM_DAYS - 1), { Qt::DisplayRole  });
-    }
-
-    void removeInvalidRooms(QStringList const& rs) {
-        // current room doesn't have to be checked because it should be set by combobox
-        // because only non current rooms can be invalid the view doesn't need to refresh
-        // pretty inefficient but you know whatever and I'm pretty sure no dangling iterators
-        for (auto const& key : schedules.keys())
-            if (!rs.contains(key))
-                schedules.remove(key);
-    }
-
-    void removeInvalidTeachers(QStringList const& ts) {
-        for (auto& schedule : schedules)
-            for (auto& day : schedule)
-                for (auto& slot : day)
-                    if (!ts.contains(slot.teacher_))
-                        slot.clear();
-        emit dataChanged(index(0, 0), index(NUM_TIMES - 1, NUM_DAYS - 1), { Qt::DisplayRole  });
-    }
-
-    void activitiesFromJson(QJsonArray const& array,
-                            QStringList const& allowedRooms,
-                            QStringList const& allowedGroups,
-                            QStringList const& allowedClasses,
-                            QStringList const& allowedTeachers) {
-        // loading new values should clear the existing values
-        schedules.clear();
-
-        // no new entries could be added (because one of rooms, groups, teachers has no allowed values)
-        if (allowedRooms.empty() || allowedGroups.empty() || allowedClasses.empty() || allowedTeachers.empty()) {
-            // but already cleared
-            emit dataChanged(index(0, 0), index(NUM_TIMES - 1, NUM_DAYS - 1), { Qt::DisplayRole });
-            return;
-        }
+    // the names in these are the ones that were taken out of the dictionaries,
+    // only cells referencing them are cleared, and refreshed if they're on display
+    void removeClasses(QStringList const& cs) {
+        auto refresh = [this] (quint32 room, int day, int time) { this->refresh(room, day, time); };
+        for (auto const& name : cs)
+            if (auto id = timetable_.classes.find(name))
+                timetable_.removeClass(id, refresh);
+    }
 
-        // "activities": [
-        //      { "room": "101", "group": "1a", "class": "mat", "slot": 1, "day": 1, "teacher": "kowalski"},
-        // ]
-        for (auto a : array) {
-            if (!a.isObject()) {
-                qDebug() << "elemements of \"activities\" should be objects";
-                continue;
-            }
-            auto activity = a.toObject();
-            if (!activity["room"].isString()) {
-                qDebug() << "\"room\" should be a string";
-                continue;
-            }
-            if (!activity["group"].isString()) {
-                qDebug() << "\"group\" should be a string";
-                continue;
-            }
-            if (!activity["class"].isString()) {
-                qDebug() << "\"class\" should be a string";
-                continue;
-            }
-            if (!activity["slot"].isDouble()) {
-                qDebug() << "\"slot\" should be a double";
-                continue;
-            }
-            if (!activity["day"].isDouble()) {
-                qDebug() << "\"day\" should be a string";
-                continue;
-            }
-            if (!activity["teacher"].isString()) {
-                qDebug() << "\"teacher\" should be a string";
-                continue;
-            }
-
-            auto room_   = activity["room"].toString();
-            auto group   = activity["group"].toString();
-            auto class_  = activity["class"].toString();
-            auto slot    = activity["slot"].toInt();
-            auto day     = activity["day"].toInt();
-            auto teacher = activity["teacher"].toString();
-
-            if (!allowedRooms.contains(room_)) {
-                qDebug() << "\"room\" for this activity wasn't declared in the \"rooms\" array";
-                continue;
-            }
-
-            if (!allowedGroups.contains(group)) {
-                qDebug() << "\"group\" for this activity wasn't declared in the \"groups\" array";
-                continue;
-            }
-
-            if (!allowedClasses.contains(class_)) {
-                qDebug() << "\"class\" for this activity wasn't delcared in the \"classes\" array";
-                continue;
-            }
-
-            if (!allowedTeachers.contains(teacher)) {
-                qDebug() << "\"teacher\" for this activity wasn't delcared in the \"teachers\" array";
-                continue;
-            }
-
-            if (day > NUM_DAYS) {
-                qDebug() << "\"day\" should be from 0 to 4 (0 - Monday, 4 - Friday)";
-                continue;
-            }
-
-            if (slot > NUM_TIMES) {
-                qDebug() << "\"slot\" should be from 0 - 8 (0 - 08:00-08:45, 8 - 15:30-16:15)";
-                continue;
-            }
-
-            schedules[room_][day][slot] = { group, class_, teacher };
-        }
-        emit dataChanged(index(0, 0), index(NUM_TIMES - 1, NUM_DAYS - 1), { Qt::DisplayRole });
-    }
-
-    auto activitiesToJson() const -> QJsonArray {
-        // "activities": [
-        //      { "room": "101", "group": "1a", "class": "mat", "slot": 1, "day": 1, "teacher": "kowalski"},
-        // ]
-        auto activities = QJsonArray {};
-        for (auto it = schedules.begin(); it != schedules.end(); it++)
-            for (auto day = 0; day < NUM_DAYS; day++)
-                for (auto slot = 0; slot < NUM_TIMES; slot++) {
-                    auto const& schedule = *it;
-                    if (auto const& entry = schedule[day][slot]; !entry.isEmpty()) {
-                        auto activity = QJsonObject {};
-                        activity["room"]    = it.key();
-                        activity["group"]   = entry.group_;
-                        activity["class"]   = entry.class_;
-                        activity["slot"]    = slot;
-                        activity["day"]     = day;
-                        activity["teacher"] = entry.teacher_;
-                        activities.push_back(activity);
-                    }
-                }
-        return activities;
+    void removeGroups(QStringList const& gs) {
+        auto refresh = [this] (quint32 room, int day, int time) { this->refresh(room, day, time); };
+        for (auto const& name : gs)
+            if (auto id = timetable_.groups.find(name))
+                timetable_.removeGroup(id, refresh);
     }
 
+    void removeRooms(QStringList const& rs) {
+        // the ids stay interned, their weeks are just left empty
+        auto refresh = [this] (quint32 room, int day, int time) { this->refresh(room, day, time); };
+        for (auto const& name : rs)
+            if (auto id = timetable_.rooms.find(name))
+                timetable_.removeRoom(id, refresh);
+    }
+
+    void removeTeachers(QStringList const& ts) {
+        auto refresh = [this] (quint32 room, int day, int time) { this->refresh(room, day, time); };
+        for (auto const& name : ts)
+            if (auto id = timetable_.teachers.find(name))
+                timetable_.removeTeacher(id, refresh);
+    }
 
 public slots:
     void setActiveRoom(QString const& r) {
         room = r;
+        current = timetable_.rooms.find(r);
         emit dataChanged(index(0, 0),
             index(NUM_TIMES - 1, NUM_DAYS - 1),
             { Qt::DisplayRole });